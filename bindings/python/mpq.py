@@ -49,12 +49,21 @@ def check_error(result, func, arguments, errors=errors):
 libmpq.libmpq__version.restype = ctypes.c_char_p
 
 libmpq.libmpq__archive_open.errcheck = check_error
+libmpq.libmpq__archive_open_flags.errcheck = check_error
+libmpq.libmpq__archive_open_memory.errcheck = check_error
+libmpq.libmpq__archive_open_io.errcheck = check_error
+libmpq.libmpq__archive_open_index.errcheck = check_error
 libmpq.libmpq__archive_close.errcheck = check_error
 libmpq.libmpq__archive_size_packed.errcheck = check_error
 libmpq.libmpq__archive_size_unpacked.errcheck = check_error
 libmpq.libmpq__archive_offset.errcheck = check_error
 libmpq.libmpq__archive_version.errcheck = check_error
 libmpq.libmpq__archive_files.errcheck = check_error
+libmpq.libmpq__archive_cache.errcheck = check_error
+libmpq.libmpq__archive_cache_stats.errcheck = check_error
+libmpq.libmpq__archive_threads.errcheck = check_error
+libmpq.libmpq__archive_extract.errcheck = check_error
+libmpq.libmpq__archive_advise.errcheck = check_error
 
 libmpq.libmpq__file_size_packed.errcheck = check_error
 libmpq.libmpq__file_size_unpacked.errcheck = check_error
@@ -65,6 +74,27 @@ libmpq.libmpq__file_compressed.errcheck = check_error
 libmpq.libmpq__file_imploded.errcheck = check_error
 libmpq.libmpq__file_number.errcheck = check_error
 libmpq.libmpq__file_read.errcheck = check_error
+libmpq.libmpq__file_read_range.errcheck = check_error
+libmpq.libmpq__file_read_vector.errcheck = check_error
+libmpq.libmpq__file_extract_fd.errcheck = check_error
+libmpq.libmpq__file_read_many.errcheck = check_error
+libmpq.libmpq__file_advise.errcheck = check_error
+
+libmpq.libmpq__stream_open.errcheck = check_error
+libmpq.libmpq__stream_read.errcheck = check_error
+libmpq.libmpq__stream_readahead.errcheck = check_error
+libmpq.libmpq__stream_seek.errcheck = check_error
+libmpq.libmpq__stream_tell.errcheck = check_error
+libmpq.libmpq__stream_close.errcheck = check_error
+
+libmpq.libmpq__queue_open.errcheck = check_error
+libmpq.libmpq__queue_read.errcheck = check_error
+libmpq.libmpq__queue_read_priority.errcheck = check_error
+libmpq.libmpq__queue_cancel.errcheck = check_error
+libmpq.libmpq__queue_poll.errcheck = check_error
+libmpq.libmpq__queue_wait.errcheck = check_error
+libmpq.libmpq__queue_stats.errcheck = check_error
+libmpq.libmpq__queue_close.errcheck = check_error
 
 libmpq.libmpq__block_open_offset.errcheck = check_error
 libmpq.libmpq__block_close_offset.errcheck = check_error
@@ -75,13 +105,13 @@ __version__ = libmpq.libmpq__version()
 
 
 class Reader(object):
-    def __init__(self, file, libmpq=libmpq):
+    def __init__(self, file, readahead=0, ctypes=ctypes, libmpq=libmpq):
         self._file = file
-        self._pos = 0
-        self._buf = []
-        self._cur_block = 0
-        libmpq.libmpq__block_open_offset(self._file._archive._mpq,
-            self._file.number)
+        self._stream = ctypes.c_void_p()
+        libmpq.libmpq__stream_open(self._file._archive._mpq,
+            self._file.number, ctypes.byref(self._stream))
+        if readahead:
+            libmpq.libmpq__stream_readahead(self._stream, readahead)
     
     def __iter__(self): 
         return self
@@ -89,52 +119,32 @@ class Reader(object):
     def __repr__(self):
         return "iter(%r)" % self._file
     
-    def seek(self, offset, whence=os.SEEK_SET, os=os):
+    def seek(self, offset, whence=os.SEEK_SET, os=os, ctypes=ctypes,
+            libmpq=libmpq):
         if whence == os.SEEK_SET:
             pass
         elif whence == os.SEEK_CUR:
-            offset += self._pos
+            offset += self.tell()
         elif whence == os.SEEK_END:
             offset += self._file.unpacked_size
         else:
             raise ValueError, "invalid whence"
         
-        if offset >= self._pos:
-            self.read(offset - self._pos)
-        else:
-            self._pos = 0
-            self._buf = []
-            self._cur_block = 0
-            self.read(offset)
+        libmpq.libmpq__stream_seek(self._stream, ctypes.c_int64(offset))
     
-    def tell(self):
-        return self._pos
+    def tell(self, ctypes=ctypes, libmpq=libmpq):
+        data = ctypes.c_int64()
+        libmpq.libmpq__stream_tell(self._stream, ctypes.byref(data))
+        return data.value
     
-    def _read_block(self, ctypes=ctypes, libmpq=libmpq):
-        block_size = ctypes.c_uint64()
-        libmpq.libmpq__block_size_unpacked(self._file._archive._mpq,
-            self._file.number, self._cur_block, ctypes.byref(block_size))
-        block_data = ctypes.create_string_buffer(block_size.value)
-        libmpq.libmpq__block_read(self._file._archive._mpq,
-            self._file.number, self._cur_block,
-            block_data, ctypes.c_uint64(len(block_data)), None)
-        self._buf.append(block_data.raw)
-        self._cur_block += 1
-    
-    def read(self, size=-1):
-        while size < 0 or sum(map(len, self._buf)) < size:
-            if self._cur_block == self._file.blocks:
-                break
-            self._read_block()
-        buf = "".join(self._buf)
+    def read(self, size=-1, ctypes=ctypes, libmpq=libmpq):
         if size < 0:
-            ret = buf
-            self._buf = []
-        else:
-            ret = buf[:size]
-            self._buf = [buf[size:]]
-        self._pos += len(ret)
-        return ret
+            size = max(self._file.unpacked_size - self.tell(), 0)
+        data = ctypes.create_string_buffer(size)
+        transferred = ctypes.c_int64()
+        libmpq.libmpq__stream_read(self._stream, data, ctypes.c_int64(size),
+            ctypes.byref(transferred))
+        return data.raw[:transferred.value]
     
     def readline(self, os=os):
         line = []
@@ -166,8 +176,8 @@ class Reader(object):
     xreadlines = __iter__
     
     def __del__(self, libmpq=libmpq):
-        libmpq.libmpq__block_close_offset(self._file._archive._mpq,
-            self._file.number)
+        if getattr(self, "_stream", None):
+            libmpq.libmpq__stream_close(self._stream)
 
 
 class File(object):
@@ -200,24 +210,32 @@ class File(object):
     
     def __iter__(self, Reader=Reader):
         return Reader(self)
+    
+    def reader(self, readahead=0, Reader=Reader):
+        return Reader(self, readahead)
 
 
 class Archive(object):
     def __init__(self, source, ctypes=ctypes, File=File, libmpq=libmpq):
         self._source = source
+        self._mpq = ctypes.c_void_p()
         if isinstance(source, File):
-            assert not source.encrypted
-            assert not source.compressed
-            assert not source.imploded
             self.filename = source._archive.filename
-            offset = source._archive.offset + source.offset
+            if source.encrypted or source.compressed or source.imploded:
+                # the archive is read in place, so keep the unpacked data alive.
+                self._data = ctypes.create_string_buffer(str(source),
+                    source.unpacked_size)
+                libmpq.libmpq__archive_open_memory(ctypes.byref(self._mpq),
+                    self._data, ctypes.c_uint64(len(self._data)),
+                    ctypes.c_uint64(-1))
+            else:
+                libmpq.libmpq__archive_open(ctypes.byref(self._mpq),
+                    self.filename,
+                    ctypes.c_uint64(source._archive.offset + source.offset))
         else:
             self.filename = source
-            offset = -1
-        
-        self._mpq = ctypes.c_void_p()
-        libmpq.libmpq__archive_open(ctypes.byref(self._mpq), self.filename,
-            ctypes.c_uint64(offset))
+            libmpq.libmpq__archive_open(ctypes.byref(self._mpq), self.filename,
+                ctypes.c_uint64(-1))
         self._opened = True
         
         for field_name, field_type in [
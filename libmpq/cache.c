@@ -0,0 +1,317 @@
+/*
+ *  cache.c -- cache of unpacked blocks with a byte budget and least recently
+ *             used eviction.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* mpq-tools configuration includes. */
+#include "config.h"
+
+/* libmpq main includes. */
+#include "mpq.h"
+#include "mpq-internal.h"
+
+/* libmpq generic includes. */
+#include "cache.h"
+
+/* generic includes. */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* cached unpacked block. */
+struct mpq_cache_entry {
+	mpq_cache_entry_s *chain;		/* next entry in the same hash bucket. */
+	mpq_cache_entry_s *prev;		/* more recently used entry. */
+	mpq_cache_entry_s *next;		/* less recently used entry. */
+	uint32_t	file_number;		/* file the block belongs to. */
+	uint32_t	block_number;		/* block number inside the file. */
+	int32_t		tb;			/* number of unpacked bytes. */
+};
+
+/* number of bytes charged to the budget for one entry. */
+#define CACHE_COST(tb) ((uint64_t)sizeof(mpq_cache_entry_s) + (uint64_t)(tb))
+
+/* this function return the hash bucket of the given block. */
+static uint32_t libmpq__cache_bucket(mpq_cache_s *cache, uint32_t file_number, uint32_t block_number) {
+
+	/* mix both numbers, blocks of one file are spread over neighbouring buckets. */
+	return (file_number * 0x9E3779B1 + block_number) & (cache->bucket_count - 1);
+}
+
+/* this function remove an entry from the least recently used list. */
+static void libmpq__cache_unlink(mpq_cache_s *cache, mpq_cache_entry_s *entry) {
+
+	/* unlink from more recently used neighbour. */
+	if (entry->prev != NULL) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+
+	/* unlink from less recently used neighbour. */
+	if (entry->next != NULL) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+}
+
+/* this function insert an entry as most recently used. */
+static void libmpq__cache_link(mpq_cache_s *cache, mpq_cache_entry_s *entry) {
+
+	/* put entry in front. */
+	entry->prev = NULL;
+	entry->next = cache->head;
+
+	/* update old head or tail of empty list. */
+	if (cache->head != NULL) {
+		cache->head->prev = entry;
+	} else {
+		cache->tail = entry;
+	}
+	cache->head = entry;
+}
+
+/* this function search an entry, the cache must be locked. */
+static mpq_cache_entry_s *libmpq__cache_find(mpq_cache_s *cache, uint32_t file_number, uint32_t block_number) {
+
+	/* some common variables. */
+	mpq_cache_entry_s *entry;
+
+	/* walk the chain of the bucket. */
+	for (entry = cache->bucket[libmpq__cache_bucket(cache, file_number, block_number)]; entry != NULL; entry = entry->chain) {
+		if (entry->file_number == file_number && entry->block_number == block_number) {
+			return entry;
+		}
+	}
+
+	/* block is not cached. */
+	return NULL;
+}
+
+/* this function evict least recently used entries until the given number of bytes fits, the cache must be locked. */
+static void libmpq__cache_evict(mpq_cache_s *cache, uint64_t size) {
+
+	/* some common variables. */
+	mpq_cache_entry_s *entry;
+	mpq_cache_entry_s **link;
+
+	/* loop until enough space is free. */
+	while (cache->tail != NULL && cache->used + size > cache->budget) {
+
+		/* take least recently used entry. */
+		entry = cache->tail;
+		libmpq__cache_unlink(cache, entry);
+
+		/* remove entry from its hash bucket. */
+		for (link = &cache->bucket[libmpq__cache_bucket(cache, entry->file_number, entry->block_number)]; *link != entry; link = &(*link)->chain);
+		*link = entry->chain;
+
+		/* release entry. */
+		cache->used -= CACHE_COST(entry->tb);
+		free(entry);
+	}
+}
+
+/* this function initialize an empty and disabled cache. */
+int32_t libmpq__cache_init(mpq_cache_s *cache) {
+
+	/* cleanup all members. */
+	memset(cache, 0, sizeof(mpq_cache_s));
+
+	/* initialize lock for the readers. */
+	if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+
+		/* lock could not be created. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function free all entries and the cache itself. */
+void libmpq__cache_free(mpq_cache_s *cache) {
+
+	/* some common variables. */
+	mpq_cache_entry_s *entry;
+
+	/* free all entries. */
+	while ((entry = cache->head) != NULL) {
+		cache->head = entry->next;
+		free(entry);
+	}
+
+	/* free buckets and lock. */
+	free(cache->bucket);
+	pthread_mutex_destroy(&cache->lock);
+}
+
+/* this function set the byte budget of the cache and resize its hash buckets. */
+int32_t libmpq__cache_budget(mpq_cache_s *cache, uint64_t budget, uint32_t block_size) {
+
+	/* some common variables. */
+	uint32_t i;
+	uint32_t bucket_count   = LIBMPQ_CACHE_BUCKETS_MIN;
+	mpq_cache_entry_s **bucket = NULL;
+	mpq_cache_entry_s *entry;
+
+	/* one bucket per full block which fits into the budget. */
+	while (bucket_count < LIBMPQ_CACHE_BUCKETS_MAX && (uint64_t)bucket_count * block_size < budget) {
+		bucket_count <<= 1;
+	}
+
+	/* check if buckets are required at all. */
+	if (budget > 0 && (bucket = calloc(bucket_count, sizeof(mpq_cache_entry_s *))) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* lock the cache, readers may use it at the same time. */
+	pthread_mutex_lock(&cache->lock);
+
+	/* evict entries which do not fit into the new budget, readers check it without lock. */
+	__atomic_store_n(&cache->budget, budget, __ATOMIC_RELAXED);
+	libmpq__cache_evict(cache, 0);
+
+	/* swap buckets and put all remaining entries into the new ones. */
+	free(cache->bucket);
+	cache->bucket       = bucket;
+	cache->bucket_count = budget > 0 ? bucket_count : 0;
+	for (entry = cache->head; entry != NULL; entry = entry->next) {
+		i = libmpq__cache_bucket(cache, entry->file_number, entry->block_number);
+		entry->chain     = cache->bucket[i];
+		cache->bucket[i] = entry;
+	}
+
+	/* unlock the cache. */
+	pthread_mutex_unlock(&cache->lock);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function copy a cached block into the output buffer. */
+int32_t libmpq__cache_get(mpq_cache_s *cache, uint32_t file_number, uint32_t block_number, uint8_t *out_buf, libmpq__off_t out_size, int32_t *tb) {
+
+	/* some common variables. */
+	mpq_cache_entry_s *entry;
+
+	/* check if cache is disabled, which is the common case and needs no lock. */
+	if (__atomic_load_n(&cache->budget, __ATOMIC_RELAXED) == 0) {
+
+		/* block is not cached. */
+		return LIBMPQ_ERROR_EXIST;
+	}
+
+	/* lock the cache. */
+	pthread_mutex_lock(&cache->lock);
+
+	/* check if block is cached and fits into the output buffer. */
+	if (cache->budget == 0 ||
+	    (entry = libmpq__cache_find(cache, file_number, block_number)) == NULL ||
+	    entry->tb > out_size) {
+
+		/* count miss. */
+		cache->misses++;
+		pthread_mutex_unlock(&cache->lock);
+
+		/* block is not cached. */
+		return LIBMPQ_ERROR_EXIST;
+	}
+
+	/* copy data while locked, so the entry cannot be evicted meanwhile. */
+	memcpy(out_buf, entry + 1, entry->tb);
+	*tb = entry->tb;
+
+	/* mark entry as most recently used. */
+	libmpq__cache_unlink(cache, entry);
+	libmpq__cache_link(cache, entry);
+
+	/* count hit. */
+	cache->hits++;
+
+	/* unlock the cache. */
+	pthread_mutex_unlock(&cache->lock);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function store a copy of an unpacked block. */
+void libmpq__cache_put(mpq_cache_s *cache, uint32_t file_number, uint32_t block_number, const uint8_t *buf, int32_t tb) {
+
+	/* some common variables. */
+	mpq_cache_entry_s *entry;
+	uint32_t i;
+
+	/* check if cache is disabled or block could never fit into it. */
+	if (__atomic_load_n(&cache->budget, __ATOMIC_RELAXED) < CACHE_COST(tb) || tb < 0) {
+		return;
+	}
+
+	/* allocate and fill entry before locking, copying is the expensive part. */
+	if ((entry = malloc(sizeof(mpq_cache_entry_s) + tb)) == NULL) {
+
+		/* a cache is allowed to forget. */
+		return;
+	}
+	entry->file_number  = file_number;
+	entry->block_number = block_number;
+	entry->tb           = tb;
+	memcpy(entry + 1, buf, tb);
+
+	/* lock the cache. */
+	pthread_mutex_lock(&cache->lock);
+
+	/* check if budget shrunk meanwhile or another reader stored the same block. */
+	if (cache->budget < CACHE_COST(tb) ||
+	    libmpq__cache_find(cache, file_number, block_number) != NULL) {
+
+		/* keep the existing entry. */
+		pthread_mutex_unlock(&cache->lock);
+		free(entry);
+		return;
+	}
+
+	/* make room for the entry. */
+	libmpq__cache_evict(cache, CACHE_COST(tb));
+
+	/* insert entry into hash bucket and in front of the list. */
+	i = libmpq__cache_bucket(cache, file_number, block_number);
+	entry->chain     = cache->bucket[i];
+	cache->bucket[i] = entry;
+	libmpq__cache_link(cache, entry);
+	cache->used += CACHE_COST(tb);
+
+	/* unlock the cache. */
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* this function return the counters of the cache. */
+void libmpq__cache_stats(mpq_cache_s *cache, uint64_t *hits, uint64_t *misses, uint64_t *used) {
+
+	/* lock the cache, so all counters belong together. */
+	pthread_mutex_lock(&cache->lock);
+	*hits   = cache->hits;
+	*misses = cache->misses;
+	*used   = cache->used;
+	pthread_mutex_unlock(&cache->lock);
+}
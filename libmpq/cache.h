@@ -0,0 +1,72 @@
+/*
+ *  cache.h -- header for the cache of unpacked blocks.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+/* define cache information. */
+#define LIBMPQ_CACHE_BUCKETS_MIN		64		/* minimum number of hash buckets. */
+#define LIBMPQ_CACHE_BUCKETS_MAX		(1024 * 1024)	/* maximum number of hash buckets. */
+
+/* initialize an empty and disabled cache. */
+int32_t libmpq__cache_init(
+	mpq_cache_s		*cache
+);
+
+/* free all entries and the cache itself. */
+void libmpq__cache_free(
+	mpq_cache_s		*cache
+);
+
+/* set the byte budget, entries are evicted until they fit and zero disables the cache. */
+int32_t libmpq__cache_budget(
+	mpq_cache_s		*cache,
+	uint64_t		budget,
+	uint32_t		block_size
+);
+
+/* copy a cached block into the output buffer, returns LIBMPQ_ERROR_EXIST on a miss. */
+int32_t libmpq__cache_get(
+	mpq_cache_s		*cache,
+	uint32_t		file_number,
+	uint32_t		block_number,
+	uint8_t			*out_buf,
+	libmpq__off_t		out_size,
+	int32_t			*tb
+);
+
+/* store a copy of an unpacked block, failing to store it is not an error. */
+void libmpq__cache_put(
+	mpq_cache_s		*cache,
+	uint32_t		file_number,
+	uint32_t		block_number,
+	const uint8_t		*buf,
+	int32_t			tb
+);
+
+/* return the hit and miss counters and the number of used bytes. */
+void libmpq__cache_stats(
+	mpq_cache_s		*cache,
+	uint64_t		*hits,
+	uint64_t		*misses,
+	uint64_t		*used
+);
+
+#endif						/* _CACHE_H */
@@ -85,14 +85,16 @@ int32_t libmpq__decrypt_block(uint32_t *in_buf, uint32_t in_size, uint32_t seed)
 	/* some common variables. */
 	uint32_t seed2 = 0xEEEEEEEE;
 	uint32_t ch;
+	uint8_t *buf   = (uint8_t *)in_buf;
 
-	/* we're processing the data 4 bytes at a time. */
-	for (; in_size >= 4; in_size -= 4) {
+	/* we're processing the data 4 bytes at a time, blocks read straight into caller buffers may not be word aligned. */
+	for (; in_size >= 4; in_size -= 4, buf += 4) {
+		memcpy(&ch, buf, 4);
 		seed2    += crypt_buf[0x400 + (seed & 0xFF)];
-		ch        = *in_buf ^ (seed + seed2);
+		ch        = ch ^ (seed + seed2);
 		seed      = ((~seed << 0x15) + 0x11111111) | (seed >> 0x0B);
 		seed2     = ch + seed2 + (seed2 << 5) + 3;
-		*in_buf++ = ch;
+		memcpy(buf, &ch, 4);
 	}
 
 	/* if no error was found, return decrypted bytes. */
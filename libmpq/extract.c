@@ -20,6 +20,7 @@
  */
 
 /* generic includes. */
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -29,13 +30,153 @@
 
 /* libmpq main includes. */
 #include "mpq.h"
+#include "mpq-internal.h"
 
 /* libmpq generic includes. */
 #include "explode.h"
 #include "extract.h"
 #include "huffman.h"
+#include "scratch.h"
 #include "wave.h"
 
+/* codec state of one thread, reused for every block the thread unpacks. */
+typedef struct {
+	z_stream	zlib;				/* zlib stream, reset before each block. */
+	uint32_t	zlib_ready;			/* zlib stream was initialized. */
+	void		*bzip2_block[LIBMPQ_CODEC_BZIP2_BLOCKS];	/* memory blocks kept for bzip2. */
+	size_t		bzip2_size[LIBMPQ_CODEC_BZIP2_BLOCKS];	/* size of each kept memory block. */
+	uint32_t	bzip2_used[LIBMPQ_CODEC_BZIP2_BLOCKS];	/* kept memory block is handed out. */
+} codec_s;
+
+/* each thread gets its own codec state, so no locking is required. */
+static pthread_key_t codec_key;
+static pthread_once_t codec_once = PTHREAD_ONCE_INIT;
+static uint32_t codec_unavailable = FALSE;
+
+/* this function free the codec state of a thread. */
+static void libmpq__codec_release(void *ptr) {
+
+	/* some common variables. */
+	codec_s *codec = ptr;
+	uint32_t i;
+
+	/* free zlib stream. */
+	if (codec->zlib_ready) {
+		inflateEnd(&codec->zlib);
+	}
+
+	/* free memory blocks kept for bzip2. */
+	for (i = 0; i < LIBMPQ_CODEC_BZIP2_BLOCKS; i++) {
+		free(codec->bzip2_block[i]);
+	}
+
+	/* free codec state. */
+	free(codec);
+}
+
+/* this function create the thread key for the codec state. */
+static void libmpq__codec_key(void) {
+
+	/* codec state is freed when its thread exits. */
+	if (pthread_key_create(&codec_key, libmpq__codec_release) != 0) {
+		__atomic_store_n(&codec_unavailable, TRUE, __ATOMIC_RELAXED);
+	}
+}
+
+/* this function return the codec state of the calling thread, it is created on first use. */
+static codec_s *libmpq__codec_get(void) {
+
+	/* some common variables. */
+	codec_s *codec;
+
+	/* create thread key once. */
+	pthread_once(&codec_once, libmpq__codec_key);
+
+	/* check if thread specific data is usable at all. */
+	if (__atomic_load_n(&codec_unavailable, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+
+	/* check if thread already has codec state. */
+	if ((codec = pthread_getspecific(codec_key)) != NULL) {
+		return codec;
+	}
+
+	/* allocate memory for the codec state. */
+	if ((codec = calloc(1, sizeof(codec_s))) == NULL) {
+		return NULL;
+	}
+
+	/* remember codec state for this thread. */
+	if (pthread_setspecific(codec_key, codec) != 0) {
+		free(codec);
+		return NULL;
+	}
+
+	/* return codec state. */
+	return codec;
+}
+
+/* this function hand out memory to bzip2, blocks of the same size are reused because bzip2 has no reset. */
+static void *libmpq__codec_bzip2_alloc(void *opaque, int items, int size) {
+
+	/* some common variables. */
+	codec_s *codec = opaque;
+	size_t bytes   = (size_t)items * size;
+	uint32_t i;
+
+	/* check if thread has codec state. */
+	if (codec == NULL) {
+		return malloc(bytes);
+	}
+
+	/* search a free kept block of the requested size. */
+	for (i = 0; i < LIBMPQ_CODEC_BZIP2_BLOCKS; i++) {
+		if (!codec->bzip2_used[i] && codec->bzip2_size[i] == bytes) {
+			codec->bzip2_used[i] = TRUE;
+			return codec->bzip2_block[i];
+		}
+	}
+
+	/* search an empty slot or one with a free block of another size. */
+	for (i = 0; i < LIBMPQ_CODEC_BZIP2_BLOCKS; i++) {
+		if (!codec->bzip2_used[i]) {
+
+			/* replace the block of this slot. */
+			free(codec->bzip2_block[i]);
+			codec->bzip2_size[i] = 0;
+			if ((codec->bzip2_block[i] = malloc(bytes)) == NULL) {
+				return NULL;
+			}
+			codec->bzip2_size[i] = bytes;
+			codec->bzip2_used[i] = TRUE;
+			return codec->bzip2_block[i];
+		}
+	}
+
+	/* all slots are in use, so the block is not kept. */
+	return malloc(bytes);
+}
+
+/* this function take back memory from bzip2. */
+static void libmpq__codec_bzip2_free(void *opaque, void *ptr) {
+
+	/* some common variables. */
+	codec_s *codec = opaque;
+	uint32_t i;
+
+	/* check if block is kept. */
+	for (i = 0; codec != NULL && i < LIBMPQ_CODEC_BZIP2_BLOCKS; i++) {
+		if (codec->bzip2_block[i] == ptr && codec->bzip2_used[i]) {
+			codec->bzip2_used[i] = FALSE;
+			return;
+		}
+	}
+
+	/* free block which is not kept. */
+	free(ptr);
+}
+
 /* table with decompression bits and functions. */
 static decompress_table_s dcmp_table[] = {
 	{LIBMPQ_COMPRESSION_HUFFMAN, libmpq__decompress_huffman},	/* decompression using huffman trees. */
@@ -55,9 +196,16 @@ int32_t libmpq__decompress_huffman(uint8_t *in_buf, uint32_t in_size, uint8_t *o
 	struct huffman_tree_s *ht;
 	struct huffman_input_stream_s *is;
 
-	/* allocate memory for the huffman tree. */
-	if ((ht = malloc(sizeof(struct huffman_tree_s))) == NULL ||
-	    (is = malloc(sizeof(struct huffman_input_stream_s))) == NULL) {
+	/* take huffman tree and input stream from the scratch buffers of this thread. */
+	if ((ht = libmpq__scratch_alloc(LIBMPQ_SCRATCH_HUFFMAN, sizeof(struct huffman_tree_s))) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+	if ((is = libmpq__scratch_alloc(LIBMPQ_SCRATCH_HUFFMAN_INPUT, sizeof(struct huffman_input_stream_s))) == NULL) {
+
+		/* release huffman tree. */
+		libmpq__scratch_free(LIBMPQ_SCRATCH_HUFFMAN, ht);
 
 		/* memory allocation problem. */
 		return LIBMPQ_ERROR_MALLOC;
@@ -86,9 +234,9 @@ int32_t libmpq__decompress_huffman(uint8_t *in_buf, uint32_t in_size, uint8_t *o
 	/* save the number of copied bytes. */
 	tb = libmpq__do_decompress_huffman(ht, is, out_buf, out_size);
 
-	/* free structures. */
-	free(is);
-	free(ht);
+	/* release structures. */
+	libmpq__scratch_free(LIBMPQ_SCRATCH_HUFFMAN_INPUT, is);
+	libmpq__scratch_free(LIBMPQ_SCRATCH_HUFFMAN, ht);
 
 	/* return transferred bytes. */
 	return tb;
@@ -100,40 +248,59 @@ int32_t libmpq__decompress_zlib(uint8_t *in_buf, uint32_t in_size, uint8_t *out_
 	/* some common variables. */
 	int32_t result = 0;
 	int32_t tb     = 0;
-	z_stream z;
+	codec_s *codec = libmpq__codec_get();
+	z_stream local;
+	z_stream *z;
 
-	/* fill the stream structure for zlib. */
-	z.next_in   = (Bytef *)in_buf;
-	z.avail_in  = (uInt)in_size;
-	z.total_in  = in_size;
-	z.next_out  = (Bytef *)out_buf;
-	z.avail_out = (uInt)out_size;
-	z.total_out = 0;
-	z.zalloc    = NULL;
-	z.zfree     = NULL;
-
-	/* initialize the decompression structure, storm.dll uses zlib version 1.1.3. */
-	if ((result = inflateInit(&z)) != Z_OK) {
-
-		/* something on zlib initialization failed. */
-		return result;
-	}
+	/* check if the stream of this thread can be reused. */
+	if (codec != NULL && codec->zlib_ready) {
 
-	/* call zlib to decompress the data. */
-	if ((result = inflate(&z, Z_FINISH)) != Z_STREAM_END) {
+		/* reset stream, this keeps the window and needs no allocation. */
+		z = &codec->zlib;
+		if (inflateReset(z) != Z_OK) {
 
-		/* something on zlib decompression failed. */
-		return result;
+			/* something on zlib reset failed. */
+			return LIBMPQ_ERROR_UNPACK;
+		}
+	} else {
+
+		/* initialize the decompression structure, storm.dll uses zlib version 1.1.3. */
+		z = codec != NULL ? &codec->zlib : &local;
+		memset(z, 0, sizeof(z_stream));
+		if (inflateInit(z) != Z_OK) {
+
+			/* something on zlib initialization failed. */
+			return LIBMPQ_ERROR_UNPACK;
+		}
+
+		/* keep stream for the next block of this thread. */
+		if (codec != NULL) {
+			codec->zlib_ready = TRUE;
+		}
 	}
 
+	/* fill the stream structure for zlib. */
+	z->next_in   = (Bytef *)in_buf;
+	z->avail_in  = (uInt)in_size;
+	z->next_out  = (Bytef *)out_buf;
+	z->avail_out = (uInt)out_size;
+
+	/* call zlib to decompress the data. */
+	result = inflate(z, Z_FINISH);
+
 	/* save transferred bytes. */
-	tb = z.total_out;
+	tb = z->total_out;
 
-	/* cleanup zlib. */
-	if ((result = inflateEnd(&z)) != Z_OK) {
+	/* cleanup zlib if the stream is not kept. */
+	if (z == &local) {
+		inflateEnd(z);
+	}
 
-		/* something on zlib finalization failed. */
-		return result;
+	/* check if the whole stream was decompressed. */
+	if (result != Z_STREAM_END) {
+
+		/* something on zlib decompression failed. */
+		return LIBMPQ_ERROR_UNPACK;
 	}
 
 	/* return transferred bytes. */
@@ -148,16 +315,13 @@ int32_t libmpq__decompress_pkzip(uint8_t *in_buf, uint32_t in_size, uint8_t *out
 	uint8_t *work_buf;
 	pkzip_data_s info;
 
-	/* allocate memory for pkzip data structure. */
-	if ((work_buf = malloc(sizeof(pkzip_cmp_s))) == NULL) {
+	/* take pkzip data structure from the scratch buffers of this thread, it is cleared by the decompression. */
+	if ((work_buf = libmpq__scratch_alloc(LIBMPQ_SCRATCH_PKZIP, sizeof(pkzip_cmp_s))) == NULL) {
 
 		/* memory allocation problem. */
 		return LIBMPQ_ERROR_MALLOC;
 	}
 
-	/* cleanup. */
-	memset(work_buf, 0, sizeof(pkzip_cmp_s));
-
 	/* fill data information structure. */
 	info.in_buf   = in_buf;
 	info.in_pos   = 0;
@@ -169,8 +333,8 @@ int32_t libmpq__decompress_pkzip(uint8_t *in_buf, uint32_t in_size, uint8_t *out
 	/* do the decompression. */
 	if ((tb = libmpq__do_decompress_pkzip(work_buf, &info)) < 0) {
 
-		/* free working buffer. */
-		free(work_buf);
+		/* release working buffer. */
+		libmpq__scratch_free(LIBMPQ_SCRATCH_PKZIP, work_buf);
 
 		/* something failed on pkzip decompression. */
 		return tb;
@@ -179,8 +343,8 @@ int32_t libmpq__decompress_pkzip(uint8_t *in_buf, uint32_t in_size, uint8_t *out
 	/* save transferred bytes. */
 	tb = info.out_pos;
 
-	/* free working buffer. */
-	free(work_buf);
+	/* release working buffer. */
+	libmpq__scratch_free(LIBMPQ_SCRATCH_PKZIP, work_buf);
 
 	/* return transferred bytes. */
 	return tb;
@@ -192,17 +356,21 @@ int32_t libmpq__decompress_bzip2(uint8_t *in_buf, uint32_t in_size, uint8_t *out
 	/* some common variables. */
 	int32_t result = 0;
 	int32_t tb     = 0;
+	uint32_t avail_in;
+	uint32_t avail_out;
 	bz_stream strm;
 
-	/* initialize the bzlib decompression. */
-	strm.bzalloc = NULL;
-	strm.bzfree  = NULL;
+	/* initialize the bzlib decompression, memory is taken from the blocks kept by this thread. */
+	memset(&strm, 0, sizeof(bz_stream));
+	strm.bzalloc = libmpq__codec_bzip2_alloc;
+	strm.bzfree  = libmpq__codec_bzip2_free;
+	strm.opaque  = libmpq__codec_get();
 
 	/* initialize the structure. */
-	if ((result = BZ2_bzDecompressInit(&strm, 0, 0)) != BZ_OK) {
+	if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) {
 
 		/* something on bzlib initialization failed. */
-		return result;
+		return LIBMPQ_ERROR_UNPACK;
 	}
 
 	/* fill the stream structure for bzlib. */
@@ -211,8 +379,12 @@ int32_t libmpq__decompress_bzip2(uint8_t *in_buf, uint32_t in_size, uint8_t *out
 	strm.next_out  = (char *)out_buf;
 	strm.avail_out = out_size;
 
-	/* do the decompression. */
-	while (BZ2_bzDecompress(&strm) != BZ_STREAM_END);
+	/* do the decompression until the end of stream, an error or no more progress. */
+	do {
+		avail_in  = strm.avail_in;
+		avail_out = strm.avail_out;
+		result    = BZ2_bzDecompress(&strm);
+	} while (result == BZ_OK && (strm.avail_in != avail_in || strm.avail_out != avail_out));
 
 	/* save transferred bytes. */
 	tb = strm.total_out_lo32;
@@ -220,6 +392,13 @@ int32_t libmpq__decompress_bzip2(uint8_t *in_buf, uint32_t in_size, uint8_t *out
 	/* cleanup of bzip stream. */
 	BZ2_bzDecompressEnd(&strm);
 
+	/* check if the whole stream was decompressed. */
+	if (result != BZ_STREAM_END) {
+
+		/* something on bzlib decompression failed or the data is truncated. */
+		return LIBMPQ_ERROR_UNPACK;
+	}
+
 	/* return transferred bytes. */
 	return tb;
 }
@@ -299,8 +478,8 @@ int32_t libmpq__decompress_multi(uint8_t *in_buf, uint32_t in_size, uint8_t *out
 	/* if multiple decompressions should be made, we need temporary buffer for the data. */
 	if (count > 1) {
 
-		/* allocate memory for temporary buffer. */
-		if ((temp_buf = malloc(out_size)) == NULL) {
+		/* take temporary buffer from the scratch buffers of this thread. */
+		if ((temp_buf = libmpq__scratch_alloc(LIBMPQ_SCRATCH_MULTI, out_size)) == NULL) {
 
 			/* memory allocation problem. */
 			return LIBMPQ_ERROR_MALLOC;
@@ -330,8 +509,8 @@ int32_t libmpq__decompress_multi(uint8_t *in_buf, uint32_t in_size, uint8_t *out
 			/* decompress buffer using corresponding function. */
 			if ((tb = dcmp_table[i].decompress(in_buf, in_size, work_buf, out_size)) < 0) {
 
-				/* free temporary buffer. */
-				free(temp_buf);
+				/* release temporary buffer. */
+				libmpq__scratch_free(LIBMPQ_SCRATCH_MULTI, temp_buf);
 
 				/* something on decompression failed. */
 				return tb;
@@ -353,8 +532,8 @@ int32_t libmpq__decompress_multi(uint8_t *in_buf, uint32_t in_size, uint8_t *out
 		memcpy(out_buf, in_buf, out_size);
 	}
 
-	/* free temporary buffer. */
-	free(temp_buf);
+	/* release temporary buffer. */
+	libmpq__scratch_free(LIBMPQ_SCRATCH_MULTI, temp_buf);
 
 	/* return transferred bytes. */
 	return tb;
@@ -29,12 +29,15 @@
 #define LIBMPQ_COMPRESSION_WAVE_MONO		0x40		/* adpcm 4:1 compression. (introduced in starcraft) */
 #define LIBMPQ_COMPRESSION_WAVE_STEREO		0x80		/* adpcm 4:1 compression. (introduced in starcraft) */
 
+/* define number of memory blocks each thread keeps for bzip2, it allocates at most three per stream. */
+#define LIBMPQ_CODEC_BZIP2_BLOCKS		4
+
 /*
  *  table for decompression functions, return value for all functions
  *  is the transferred data size or one of the following error constants:
  *
  *  LIBMPQ_ERROR_MALLOC
- *  LIBMPQ_ERROR_DECOMPRESS
+ *  LIBMPQ_ERROR_UNPACK
  */
 typedef int32_t		(*DECOMPRESS)(uint8_t *, uint32_t, uint8_t *, uint32_t);
 typedef struct {
@@ -0,0 +1,559 @@
+/*
+ *  index.c -- sidecar index which caches the decrypted hash and block tables
+ *             and all decoded packed block offset tables of an archive.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* mpq-tools configuration includes. */
+#include "config.h"
+
+/* libmpq main includes. */
+#include "mpq.h"
+#include "mpq-internal.h"
+
+/* libmpq generic includes. */
+#include "index.h"
+
+/* generic includes. */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* memory mapping includes. */
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+/* support for platform specific things */
+#include "platform.h"
+
+/* round up to the alignment of index sections. */
+#define INDEX_ALIGN(size) (((uint64_t)(size) + 7) & ~(uint64_t)7)
+
+/* this function check if the given section is aligned and inside the index. */
+static uint32_t libmpq__index_range(size_t index_size, uint64_t offset, uint64_t size) {
+
+	/* check alignment and bounds without overflowing. */
+	return (offset & 7) == 0 && offset <= index_size && size <= index_size - offset;
+}
+
+/* this function hash the raw header bytes, so a rewritten archive with same size and time is detected. */
+static int32_t libmpq__index_header_hash(mpq_archive_s *mpq_archive, libmpq__off_t archive_offset, libmpq__off_t storage_size, uint64_t *header_hash) {
+
+	/* some common variables. */
+	uint8_t buffer[sizeof(mpq_header_s) + sizeof(mpq_header_ex_s)];
+	libmpq__off_t size = sizeof(buffer);
+	libmpq__off_t i;
+	int32_t result;
+
+	/* check if archive offset is inside the storage. */
+	if (archive_offset < 0 || archive_offset >= storage_size) {
+
+		/* index belongs to another archive. */
+		return LIBMPQ_ERROR_FORMAT;
+	}
+
+	/* the extended header is optional, so don't read beyond the storage. */
+	if (size > storage_size - archive_offset) {
+		size = storage_size - archive_offset;
+	}
+
+	/* read raw header bytes. */
+	if ((result = mpq_archive->io->read(mpq_archive->io_handle, buffer, size, archive_offset)) < 0) {
+
+		/* something on read failed. */
+		return result;
+	}
+
+	/* compute 64 bit fnv-1a hash over the header. */
+	for (*header_hash = 0xcbf29ce484222325ULL, i = 0; i < size; i++) {
+		*header_hash = (*header_hash ^ buffer[i]) * 0x100000001b3ULL;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function map the index and use its tables if it matches the archive. */
+int32_t libmpq__index_load(mpq_archive_s *mpq_archive, const char *index_filename, libmpq__off_t search_offset, int64_t storage_mtime) {
+
+	/* some common variables. */
+	uint8_t *index      = NULL;
+	size_t index_size   = 0;
+	size_t done         = 0;
+	uint32_t mapped     = FALSE;
+	uint64_t header_hash;
+	int32_t result      = LIBMPQ_ERROR_FORMAT;
+	index_header_s *header;
+	mpq_block_s *block;
+	mpq_block_ex_s *block_ex;
+	mpq_map_s *map;
+	uint64_t block_end;
+	uint32_t i;
+	libmpq__off_t storage_size;
+	struct stat st;
+	ssize_t rb;
+	int fd;
+
+	/* check if index exists and is readable. */
+	if ((fd = open(index_filename, O_RDONLY | O_BINARY)) < 0) {
+
+		/* index could not be opened. */
+		return LIBMPQ_ERROR_OPEN;
+	}
+
+	/* get size of the index. */
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(index_header_s) || (uint64_t)st.st_size > (size_t)-1) {
+
+		/* index is unusable. */
+		close(fd);
+		return LIBMPQ_ERROR_FORMAT;
+	}
+
+	/* store size of index. */
+	index_size = st.st_size;
+
+#ifdef HAVE_MMAP
+
+	/* map index private, so flags updated on open never reach the file. */
+	if ((index = mmap(NULL, index_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+		mapped = TRUE;
+	} else {
+		index = NULL;
+	}
+#endif
+
+	/* check if we have to read the index into memory. */
+	if (index == NULL) {
+
+		/* allocate memory for the index. */
+		if ((index = malloc(index_size)) == NULL) {
+
+			/* memory allocation problem. */
+			close(fd);
+			return LIBMPQ_ERROR_MALLOC;
+		}
+
+		/* read the whole index. */
+		while (done < index_size) {
+
+			/* read next chunk from index. */
+			if ((rb = read(fd, index + done, index_size - done)) <= 0) {
+
+				/* check if read was interrupted. */
+				if (rb < 0 && errno == EINTR) {
+					continue;
+				}
+
+				/* something on read failed. */
+				free(index);
+				close(fd);
+				return LIBMPQ_ERROR_READ;
+			}
+
+			/* move to the remaining part. */
+			done += rb;
+		}
+	}
+
+	/* the file descriptor is no longer required. */
+	close(fd);
+
+	/* get index header. */
+	header = (index_header_s *)index;
+
+	/* check if index belongs to this archive and was written by this library version. */
+	if (header->magic != LIBMPQ_INDEX_MAGIC ||
+	    header->version != LIBMPQ_INDEX_VERSION ||
+	    header->storage_mtime != storage_mtime ||
+	    header->search_offset != search_offset ||
+	    mpq_archive->io->size(mpq_archive->io_handle, &storage_size) < 0 ||
+	    header->storage_size != storage_size ||
+	    libmpq__index_header_hash(mpq_archive, header->archive_offset, storage_size, &header_hash) < 0 ||
+	    header->header_hash != header_hash) {
+
+		/* index is stale. */
+		goto error;
+	}
+
+	/* check if all sections are inside the index. */
+	if (header->files > header->mpq_header.block_table_count ||
+	    !libmpq__index_range(index_size, header->hash_offset, (uint64_t)header->mpq_header.hash_table_count * sizeof(mpq_hash_s)) ||
+	    !libmpq__index_range(index_size, header->block_offset, (uint64_t)header->mpq_header.block_table_count * sizeof(mpq_block_s)) ||
+	    !libmpq__index_range(index_size, header->block_ex_offset, (uint64_t)header->mpq_header.block_table_count * sizeof(mpq_block_ex_s)) ||
+	    !libmpq__index_range(index_size, header->map_offset, (uint64_t)header->mpq_header.block_table_count * sizeof(mpq_map_s)) ||
+	    !libmpq__index_range(index_size, header->file_offset, (uint64_t)header->files * sizeof(index_file_s))) {
+
+		/* index is corrupt. */
+		goto error;
+	}
+
+	/* get tables of the index. */
+	block    = (mpq_block_s *)(index + header->block_offset);
+	block_ex = (mpq_block_ex_s *)(index + header->block_ex_offset);
+	map      = (mpq_map_s *)(index + header->map_offset);
+
+	/* check if all files point to existing blocks inside the archive, the tables are used without further checks. */
+	for (i = 0; i < header->files; i++) {
+
+		/* check if block entry is valid. */
+		if (map[i].block_table_indices >= header->mpq_header.block_table_count ||
+		    (block[map[i].block_table_indices].flags & LIBMPQ_FLAG_EXISTS) == 0) {
+
+			/* index is corrupt. */
+			goto error;
+		}
+
+		/* get end of block in the archive. */
+		block_end = header->archive_offset + block[map[i].block_table_indices].offset + ((uint64_t)block_ex[map[i].block_table_indices].offset_high << 32) + block[map[i].block_table_indices].packed_size;
+
+		/* check if block is inside the archive. */
+		if (header->archive_offset < 0 || block_end > (uint64_t)storage_size) {
+
+			/* index is corrupt. */
+			goto error;
+		}
+	}
+
+	/* allocate memory for the file pointers, they are never stored. */
+	if ((mpq_archive->mpq_file        = calloc(header->mpq_header.block_table_count, sizeof(mpq_file_s))) == NULL ||
+	    (mpq_archive->mpq_file_closed = calloc(header->mpq_header.block_table_count, sizeof(mpq_file_s *))) == NULL) {
+
+		/* memory allocation problem. */
+		result = LIBMPQ_ERROR_MALLOC;
+		goto error;
+	}
+
+	/* use header and tables of the index. */
+	mpq_archive->mpq_header     = header->mpq_header;
+	mpq_archive->mpq_header_ex  = header->mpq_header_ex;
+	mpq_archive->block_size     = 512 << header->mpq_header.block_size;
+	mpq_archive->archive_offset = header->archive_offset;
+	mpq_archive->mpq_hash       = (mpq_hash_s *)(index + header->hash_offset);
+	mpq_archive->mpq_block      = block;
+	mpq_archive->mpq_block_ex   = block_ex;
+	mpq_archive->mpq_map        = map;
+	mpq_archive->files          = header->files;
+	mpq_archive->index          = index;
+	mpq_archive->index_size     = index_size;
+	mpq_archive->index_mapped   = mapped;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+
+error:
+
+	/* free file pointers, the archive is loaded without index. */
+	free(mpq_archive->mpq_file);
+	free(mpq_archive->mpq_file_closed);
+	mpq_archive->mpq_file        = NULL;
+	mpq_archive->mpq_file_closed = NULL;
+
+#ifdef HAVE_MMAP
+
+	/* unmap index. */
+	if (mapped) {
+		munmap(index, index_size);
+		return result;
+	}
+#endif
+
+	/* free index. */
+	free(index);
+
+	/* return error constant. */
+	return result;
+}
+
+/* this function create a new temporary file next to the index, it is never shared with another writer. */
+static int libmpq__index_temp(const char *index_filename, char *temp_filename, size_t temp_size) {
+
+	/* some common variables. */
+#ifndef HAVE_MKSTEMP
+	static volatile uint32_t counter = 0;
+	uint32_t tries;
+#endif
+	int fd = -1;
+
+#ifdef HAVE_MKSTEMP
+
+	/* let the system pick a unique name. */
+	snprintf(temp_filename, temp_size, "%s.XXXXXX", index_filename);
+	if ((fd = mkstemp(temp_filename)) < 0) {
+		return -1;
+	}
+
+#ifndef _WIN32
+
+	/* mkstemp() creates the file private, but the index is readable like the old one. */
+	fchmod(fd, 0644);
+#endif
+#else
+
+	/* try unique names until one is free, exclusive creation never reuses a file of another writer. */
+	for (tries = 0; tries < 100; tries++) {
+		snprintf(temp_filename, temp_size, "%s.%ld.%lu.tmp", index_filename, (long)getpid(), (unsigned long)counter++);
+		if ((fd = open(temp_filename, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0644)) >= 0 || errno != EEXIST) {
+			break;
+		}
+	}
+#endif
+
+	/* return file descriptor or error. */
+	return fd;
+}
+
+/* this function write the tables and all packed block offset tables of the loaded archive to the index. */
+int32_t libmpq__index_save(mpq_archive_s *mpq_archive, const char *index_filename, libmpq__off_t search_offset, int64_t storage_mtime) {
+
+	/* some common variables. */
+	uint8_t *index       = NULL;
+	uint64_t index_size  = 0;
+	uint64_t done        = 0;
+	uint32_t i;
+	uint32_t flags;
+	int32_t result       = 0;
+	char *temp_filename  = NULL;
+	index_header_s header;
+	index_file_s *file   = NULL;
+	libmpq__off_t storage_size;
+	ssize_t wb;
+	int fd               = -1;
+	uint32_t created     = FALSE;
+
+	/* build header, the hash detects archives rewritten in place. */
+	memset(&header, 0, sizeof(header));
+	header.magic          = LIBMPQ_INDEX_MAGIC;
+	header.version        = LIBMPQ_INDEX_VERSION;
+	header.storage_mtime  = storage_mtime;
+	header.search_offset  = search_offset;
+	header.archive_offset = mpq_archive->archive_offset;
+	header.mpq_header     = mpq_archive->mpq_header;
+	header.mpq_header_ex  = mpq_archive->mpq_header_ex;
+	header.files          = mpq_archive->files;
+	if ((result = mpq_archive->io->size(mpq_archive->io_handle, &storage_size)) < 0 ||
+	    (result = libmpq__index_header_hash(mpq_archive, mpq_archive->archive_offset, storage_size, &header.header_hash)) < 0) {
+
+		/* something on reading archive failed. */
+		return result;
+	}
+	header.storage_size = storage_size;
+
+	/* allocate memory for the file entries. */
+	if ((file = calloc(mpq_archive->files + 1, sizeof(index_file_s))) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* compute position of the tables. */
+	index_size             = INDEX_ALIGN(sizeof(index_header_s));
+	header.hash_offset     = index_size;
+	index_size            += INDEX_ALIGN((uint64_t)mpq_archive->mpq_header.hash_table_count * sizeof(mpq_hash_s));
+	header.block_offset    = index_size;
+	index_size            += INDEX_ALIGN((uint64_t)mpq_archive->mpq_header.block_table_count * sizeof(mpq_block_s));
+	header.block_ex_offset = index_size;
+	index_size            += INDEX_ALIGN((uint64_t)mpq_archive->mpq_header.block_table_count * sizeof(mpq_block_ex_s));
+	header.map_offset      = index_size;
+	index_size            += INDEX_ALIGN((uint64_t)mpq_archive->mpq_header.block_table_count * sizeof(mpq_map_s));
+	header.file_offset     = index_size;
+	index_size            += INDEX_ALIGN((uint64_t)mpq_archive->files * sizeof(index_file_s));
+
+	/* open the packed block offset table of every file which has one stored in the archive. */
+	for (i = 0; i < mpq_archive->files; i++) {
+
+		/* get flags of file. */
+		flags = mpq_archive->mpq_block[mpq_archive->mpq_map[i].block_table_indices].flags;
+
+		/* other tables are computed without reading the archive, so storing them gains nothing. */
+		if ((flags & LIBMPQ_FLAG_COMPRESSED) == 0 || (flags & LIBMPQ_FLAG_SINGLE) != 0) {
+			continue;
+		}
+
+		/* files without known seed are left out and fail on open as usual. */
+		if (libmpq__block_open_offset(mpq_archive, i) < 0) {
+			continue;
+		}
+
+		/* get size of the table. */
+		file[i].seed    = mpq_archive->mpq_file[i]->seed;
+		file[i].size    = sizeof(uint32_t) * ((mpq_archive->mpq_block[mpq_archive->mpq_map[i].block_table_indices].unpacked_size + mpq_archive->block_size - 1) / mpq_archive->block_size + 1);
+		file[i].offset  = index_size;
+
+		/* check if data has one extra entry. */
+		if ((flags & LIBMPQ_FLAG_CRC) != 0) {
+			file[i].size += sizeof(uint32_t);
+		}
+
+		/* move behind the table. */
+		index_size += INDEX_ALIGN(file[i].size);
+	}
+
+	/* check if index fits into memory. */
+	if (index_size > (size_t)-1 || (index = calloc(1, index_size)) == NULL) {
+
+		/* memory allocation problem. */
+		result = LIBMPQ_ERROR_MALLOC;
+		goto error;
+	}
+
+	/* copy header and tables, block flags are copied after opening all files, because open may update them. */
+	memcpy(index, &header, sizeof(index_header_s));
+	memcpy(index + header.hash_offset, mpq_archive->mpq_hash, (size_t)mpq_archive->mpq_header.hash_table_count * sizeof(mpq_hash_s));
+	memcpy(index + header.block_offset, mpq_archive->mpq_block, (size_t)mpq_archive->mpq_header.block_table_count * sizeof(mpq_block_s));
+	memcpy(index + header.block_ex_offset, mpq_archive->mpq_block_ex, (size_t)mpq_archive->mpq_header.block_table_count * sizeof(mpq_block_ex_s));
+	memcpy(index + header.map_offset, mpq_archive->mpq_map, (size_t)mpq_archive->mpq_header.block_table_count * sizeof(mpq_map_s));
+	memcpy(index + header.file_offset, file, (size_t)mpq_archive->files * sizeof(index_file_s));
+
+	/* copy decoded packed block offset tables. */
+	for (i = 0; i < mpq_archive->files; i++) {
+		if (file[i].size != 0) {
+			memcpy(index + file[i].offset, mpq_archive->mpq_file[i]->packed_offset, file[i].size);
+		}
+	}
+
+	/* allocate memory for the temporary filename. */
+	if ((temp_filename = malloc(strlen(index_filename) + 32)) == NULL) {
+
+		/* memory allocation problem. */
+		result = LIBMPQ_ERROR_MALLOC;
+		goto error;
+	}
+
+	/* write into a new temporary file next to the index first, so concurrent readers never see a partial index. */
+	if ((fd = libmpq__index_temp(index_filename, temp_filename, strlen(index_filename) + 32)) < 0) {
+
+		/* index could not be created. */
+		result = LIBMPQ_ERROR_OPEN;
+		goto error;
+	}
+	created = TRUE;
+
+	/* write the whole index. */
+	while (done < index_size) {
+
+		/* write next chunk to index. */
+		if ((wb = write(fd, index + done, index_size - done)) <= 0) {
+
+			/* check if write was interrupted. */
+			if (wb < 0 && errno == EINTR) {
+				continue;
+			}
+
+			/* something on write failed. */
+			result = LIBMPQ_ERROR_WRITE;
+			goto error;
+		}
+
+		/* move to the remaining part. */
+		done += wb;
+	}
+
+	/* close index. */
+	result = close(fd) < 0 ? LIBMPQ_ERROR_WRITE : LIBMPQ_SUCCESS;
+	fd     = -1;
+
+	/* move index into place, an older index is replaced atomically. */
+	if (result == LIBMPQ_SUCCESS && rename(temp_filename, index_filename) < 0) {
+		result = LIBMPQ_ERROR_WRITE;
+	}
+
+error:
+
+	/* remove partial index, but only if it was created by us. */
+	if (result < 0 && created) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		unlink(temp_filename);
+	}
+
+	/* close all packed block offset tables opened above. */
+	for (i = 0; i < mpq_archive->files; i++) {
+		if (file[i].size != 0) {
+			libmpq__block_close_offset(mpq_archive, i);
+		}
+	}
+
+	/* free buffers. */
+	free(temp_filename);
+	free(index);
+	free(file);
+
+	/* return error constant. */
+	return result;
+}
+
+/* this function copy the packed block offset table of a file out of the index. */
+int32_t libmpq__index_offset(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t *packed_offset, uint32_t packed_size, uint32_t *seed) {
+
+	/* some common variables. */
+	index_header_s *header;
+	index_file_s *file;
+
+	/* check if index is loaded. */
+	if (mpq_archive->index == NULL) {
+
+		/* no index is used. */
+		return LIBMPQ_ERROR_OPEN;
+	}
+
+	/* get file entry, the file number was checked by the caller. */
+	header = (index_header_s *)mpq_archive->index;
+	file   = (index_file_s *)(mpq_archive->index + header->file_offset) + file_number;
+
+	/* check if table is stored and has the expected size. */
+	if (file->size == 0 || file->size != packed_size || !libmpq__index_range(mpq_archive->index_size, file->offset, file->size)) {
+
+		/* table must be read from the archive. */
+		return LIBMPQ_ERROR_EXIST;
+	}
+
+	/* copy decoded table and seed. */
+	memcpy(packed_offset, mpq_archive->index + file->offset, packed_size);
+	*seed = file->seed;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function release the index, the tables pointing into it become invalid. */
+void libmpq__index_close(mpq_archive_s *mpq_archive) {
+
+	/* check if index is loaded. */
+	if (mpq_archive->index == NULL) {
+		return;
+	}
+
+#ifdef HAVE_MMAP
+
+	/* check if index was mapped. */
+	if (mpq_archive->index_mapped) {
+		munmap(mpq_archive->index, mpq_archive->index_size);
+		mpq_archive->index = NULL;
+		return;
+	}
+#endif
+
+	/* free index. */
+	free(mpq_archive->index);
+	mpq_archive->index = NULL;
+}
@@ -0,0 +1,84 @@
+/*
+ *  index.h -- header for the sidecar index which caches decrypted tables.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _INDEX_H
+#define _INDEX_H
+
+/* define sidecar index information. */
+#define LIBMPQ_INDEX_MAGIC			0x4951504D	/* index file header ('MPQI') */
+#define LIBMPQ_INDEX_VERSION			1		/* bumped whenever the layout below changes. */
+
+/* index file header, all values are stored in host byte order and every section starts 8 byte aligned. */
+typedef struct {
+	uint32_t	magic;			/* the 0x4951504D ('MPQI') signature. */
+	uint32_t	version;		/* layout version of the index. */
+	int64_t		storage_size;		/* size of the archive file the index was built from. */
+	int64_t		storage_mtime;		/* modification time of the archive file the index was built from. */
+	int64_t		search_offset;		/* archive offset given on open, -1 if the header was searched. */
+	int64_t		archive_offset;		/* absolute start position of archive. */
+	uint64_t	header_hash;		/* hash of the raw archive header bytes. */
+	mpq_header_s	mpq_header;		/* archive header after version fixups. */
+	mpq_header_ex_s	mpq_header_ex;		/* archive extended header. */
+	uint32_t	files;			/* number of files in archive. */
+	uint64_t	hash_offset;		/* position of the decrypted hash table. */
+	uint64_t	block_offset;		/* position of the decrypted block table. */
+	uint64_t	block_ex_offset;	/* position of the extended block table. */
+	uint64_t	map_offset;		/* position of the file to block map. */
+	uint64_t	file_offset;		/* position of the per file entries. */
+} index_header_s;
+
+/* index entry for each file, describes its decoded packed block offset table. */
+typedef struct {
+	uint32_t	seed;			/* seed used for file decrypt. */
+	uint32_t	size;			/* size of the packed block offset table, zero if not stored. */
+	uint64_t	offset;			/* position of the packed block offset table. */
+} index_file_s;
+
+/* map the index and use its tables if it matches the archive. */
+int32_t libmpq__index_load(
+	mpq_archive_s		*mpq_archive,
+	const char		*index_filename,
+	libmpq__off_t		search_offset,
+	int64_t			storage_mtime
+);
+
+/* write the tables and all packed block offset tables of the loaded archive to the index. */
+int32_t libmpq__index_save(
+	mpq_archive_s		*mpq_archive,
+	const char		*index_filename,
+	libmpq__off_t		search_offset,
+	int64_t			storage_mtime
+);
+
+/* copy the packed block offset table of a file out of the index. */
+int32_t libmpq__index_offset(
+	mpq_archive_s		*mpq_archive,
+	uint32_t		file_number,
+	uint32_t		*packed_offset,
+	uint32_t		packed_size,
+	uint32_t		*seed
+);
+
+/* release the index, the tables pointing into it become invalid. */
+void libmpq__index_close(
+	mpq_archive_s		*mpq_archive
+);
+
+#endif						/* _INDEX_H */
@@ -0,0 +1,639 @@
+/*
+ *  io.c -- built-in storage backends for reading mpq archives from files,
+ *          memory mappings and caller supplied buffers.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* mpq-tools configuration includes. */
+#include "config.h"
+
+/* libmpq main includes. */
+#include "mpq.h"
+#include "mpq-internal.h"
+
+/* libmpq generic includes. */
+#include "io.h"
+#include "scratch.h"
+#include "uring.h"
+
+/* generic includes. */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* memory mapping includes. */
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+/* in kernel copy includes. */
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+/* support for platform specific things */
+#include "platform.h"
+
+/* file backend handle. */
+typedef struct {
+	int		fd;			/* file descriptor, only accessed with pread so it has no shared position. */
+} io_file_s;
+
+/* memory backend handle, used for memory mappings and caller supplied buffers. */
+typedef struct {
+	uint8_t		*buffer;		/* start of archive data. */
+	libmpq__off_t	size;			/* size of archive data. */
+	uint32_t	mapped;			/* buffer was mapped by us and must be unmapped on close. */
+	int		fd;			/* file descriptor of the mapping, kept to drop the page cache, or -1. */
+} io_memory_s;
+
+/* this function read all requests one after another. */
+static int32_t libmpq__io_read_each(const libmpq__io_s *io, void *handle, libmpq__io_request_s *requests, uint32_t count, libmpq__io_complete_t complete, void *data) {
+
+	/* some common variables. */
+	uint32_t i;
+	int32_t result = LIBMPQ_SUCCESS;
+
+	/* loop through all requests. */
+	for (i = 0; i < count; i++) {
+
+		/* read request and remember first error. */
+		if ((requests[i].result = io->read(handle, requests[i].buffer, requests[i].size, requests[i].offset)) < 0 && result == LIBMPQ_SUCCESS) {
+			result = requests[i].result;
+		}
+
+		/* notify caller about finished request. */
+		if (complete != NULL) {
+			complete(&requests[i], data);
+		}
+	}
+
+	/* return first error or zero. */
+	return result;
+}
+
+/* this function read size bytes from the given file offset without moving any file position. */
+static int32_t libmpq__io_file_read(void *handle, void *buffer, libmpq__off_t size, libmpq__off_t offset) {
+
+	/* some common variables. */
+	io_file_s *file = handle;
+	ssize_t rb;
+
+	/* read data from file without touching any shared file position. */
+	while (size > 0) {
+
+		/* read next chunk from file. */
+		if ((rb = pread(file->fd, buffer, size, offset)) <= 0) {
+
+			/* check if read was interrupted. */
+			if (rb < 0 && errno == EINTR) {
+				continue;
+			}
+
+			/* something on read failed. */
+			return LIBMPQ_ERROR_READ;
+		}
+
+		/* move to the remaining part. */
+		buffer  = (uint8_t *)buffer + rb;
+		size   -= rb;
+		offset += rb;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the size of the file. */
+static int32_t libmpq__io_file_size(void *handle, libmpq__off_t *size) {
+
+	/* some common variables. */
+	io_file_s *file = handle;
+	struct stat st;
+
+	/* get file information. */
+	if (fstat(file->fd, &st) < 0) {
+
+		/* something on stat failed. */
+		return LIBMPQ_ERROR_SEEK;
+	}
+
+	/* return file size. */
+	*size = st.st_size;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function close the file. */
+static int32_t libmpq__io_file_close(void *handle) {
+
+	/* some common variables. */
+	io_file_s *file = handle;
+
+	/* try to close the file. */
+	if (close(file->fd) < 0) {
+
+		/* closing failed. */
+		return LIBMPQ_ERROR_CLOSE;
+	}
+
+	/* free handle. */
+	free(file);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function pass an access hint for a range of the file to the kernel, size zero means up to the end of file. */
+static int32_t libmpq__io_file_advise(void *handle, libmpq__off_t size, libmpq__off_t offset, uint32_t advice) {
+
+#ifdef HAVE_POSIX_FADVISE
+
+	/* some common variables. */
+	io_file_s *file = handle;
+	static const int map[] = {
+		POSIX_FADV_NORMAL,		/* LIBMPQ_ADVISE_NORMAL. */
+		POSIX_FADV_SEQUENTIAL,		/* LIBMPQ_ADVISE_SEQUENTIAL. */
+		POSIX_FADV_RANDOM,		/* LIBMPQ_ADVISE_RANDOM. */
+		POSIX_FADV_WILLNEED,		/* LIBMPQ_ADVISE_WILLNEED. */
+		POSIX_FADV_DONTNEED		/* LIBMPQ_ADVISE_DONTNEED. */
+	};
+
+	/* pass hint, it returns the error instead of setting errno. */
+	if (posix_fadvise(file->fd, offset, size, map[advice]) != 0) {
+
+		/* hint was refused. */
+		return LIBMPQ_ERROR_SEEK;
+	}
+#endif
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function copy bytes from the file to the current position of fd inside the kernel, size and offset are advanced by the copied bytes. */
+static void libmpq__io_file_copy(void *handle, int fd, libmpq__off_t *size, libmpq__off_t *offset) {
+
+	/* some common variables. */
+	io_file_s *file = handle;
+	ssize_t wb      = 0;
+	int fl;
+
+	/* check if fd appends, copy_file_range and sendfile refuse it, so it is left to the read and write fallback. */
+	if ((fl = fcntl(fd, F_GETFL)) < 0 || (fl & O_APPEND) != 0) {
+		return;
+	}
+
+#ifdef __NR_copy_file_range
+
+	/* some common variables. */
+	libmpq__off_t in_offset;
+
+	/* copy between files, which may share the blocks on file systems with reflinks. */
+	while (*size > 0) {
+
+		/* copy next chunk, the syscall is used directly because the libc wrapper is a gnu extension. */
+		in_offset = *offset;
+		if ((wb = syscall(__NR_copy_file_range, file->fd, &in_offset, fd, NULL, (size_t)*size, 0)) <= 0) {
+			break;
+		}
+
+		/* move to the remaining part. */
+		*size   -= wb;
+		*offset += wb;
+	}
+#endif
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+
+	/* some common variables. */
+	off_t out_offset;
+
+	/* copy into a pipe or socket, if copy_file_range is not usable for fd. */
+	while (*size > 0) {
+
+		/* copy next chunk. */
+		out_offset = *offset;
+		if ((wb = sendfile(fd, file->fd, &out_offset, (size_t)*size)) <= 0) {
+			break;
+		}
+
+		/* move to the remaining part. */
+		*size   -= wb;
+		*offset += wb;
+	}
+#endif
+
+	/* silence unused warnings if neither copy is available, failures are left to the read and write fallback. */
+	(void)file;
+	(void)wb;
+}
+
+/* forward declaration, the uring backend falls back to the plain file backend. */
+static const libmpq__io_s io_file;
+
+/* this function read a batch of requests with io_uring or, if not available, one after another with pread. */
+static int32_t libmpq__io_file_read_batch(void *handle, libmpq__io_request_s *requests, uint32_t count, libmpq__io_complete_t complete, void *data) {
+
+	/* some common variables. */
+	io_file_s *file = handle;
+	int32_t result;
+
+	/* keep many reads in flight, so cold storage can reorder and merge them. */
+	if ((result = libmpq__uring_read_batch(file->fd, requests, count, complete, data)) != LIBMPQ_ERROR_OPEN) {
+		return result;
+	}
+
+	/* io_uring is not available, so use the synchronous path. */
+	return libmpq__io_read_each(&io_file, handle, requests, count, complete, data);
+}
+
+/* this function copy size bytes from the given offset out of memory. */
+static int32_t libmpq__io_memory_read(void *handle, void *buffer, libmpq__off_t size, libmpq__off_t offset) {
+
+	/* some common variables. */
+	io_memory_s *memory = handle;
+
+	/* check if requested range is inside the buffer. */
+	if (offset < 0 || size < 0 || offset > memory->size || size > memory->size - offset) {
+
+		/* something on read failed. */
+		return LIBMPQ_ERROR_READ;
+	}
+
+	/* copy data out of the buffer. */
+	memcpy(buffer, memory->buffer + offset, size);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the size of the buffer. */
+static int32_t libmpq__io_memory_size(void *handle, libmpq__off_t *size) {
+
+	/* some common variables. */
+	io_memory_s *memory = handle;
+
+	/* return buffer size. */
+	*size = memory->size;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function unmap the buffer if we mapped it, caller supplied buffers are left alone. */
+static int32_t libmpq__io_memory_close(void *handle) {
+
+	/* some common variables. */
+	io_memory_s *memory = handle;
+
+#ifdef HAVE_MMAP
+
+	/* check if buffer was mapped by us. */
+	if (memory->mapped && munmap(memory->buffer, memory->size) < 0) {
+
+		/* unmapping failed. */
+		return LIBMPQ_ERROR_CLOSE;
+	}
+#endif
+
+	/* close file descriptor of the mapping. */
+	if (memory->fd >= 0 && close(memory->fd) < 0) {
+
+		/* closing failed. */
+		return LIBMPQ_ERROR_CLOSE;
+	}
+
+	/* free handle. */
+	free(memory);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return a pointer into the buffer or NULL if the range is outside. */
+static const void *libmpq__io_memory_map(void *handle, libmpq__off_t size, libmpq__off_t offset) {
+
+	/* some common variables. */
+	io_memory_s *memory = handle;
+
+	/* check if requested range is inside the buffer. */
+	if (offset < 0 || size < 0 || offset > memory->size || size > memory->size - offset) {
+
+		/* range is not available in memory. */
+		return NULL;
+	}
+
+	/* return pointer into the buffer. */
+	return memory->buffer + offset;
+}
+
+/* this function pass an access hint for a range of our mapping to the kernel, caller supplied buffers are left alone. */
+static int32_t libmpq__io_memory_advise(void *handle, libmpq__off_t size, libmpq__off_t offset, uint32_t advice) {
+
+#if defined(HAVE_MMAP) && defined(HAVE_MADVISE)
+
+	/* some common variables. */
+	io_memory_s *memory = handle;
+	uintptr_t page      = sysconf(_SC_PAGESIZE);
+	uintptr_t start;
+	static const int map[] = {
+		MADV_NORMAL,			/* LIBMPQ_ADVISE_NORMAL. */
+		MADV_SEQUENTIAL,		/* LIBMPQ_ADVISE_SEQUENTIAL. */
+		MADV_RANDOM,			/* LIBMPQ_ADVISE_RANDOM. */
+		MADV_WILLNEED,			/* LIBMPQ_ADVISE_WILLNEED. */
+		MADV_DONTNEED			/* LIBMPQ_ADVISE_DONTNEED. */
+	};
+
+	/* check if buffer was mapped by us, dropping pages of a caller buffer would lose its contents, and if range is inside. */
+	if (!memory->mapped || offset < 0 || size < 0 || offset > memory->size) {
+		return LIBMPQ_SUCCESS;
+	}
+
+	/* clip range at the end of mapping. */
+	size = size == 0 || size > memory->size - offset ? memory->size - offset : size;
+
+	/* align start down to a page, the mapping is read-only, so dropping a neighbouring page only costs a refault. */
+	start = ((uintptr_t)(memory->buffer + offset)) & ~(page - 1);
+
+	/* pass hint, for LIBMPQ_ADVISE_DONTNEED this only releases our private view of the pages. */
+	if (size > 0 && madvise((void *)start, (uintptr_t)(memory->buffer + offset + size) - start, map[advice]) < 0) {
+
+		/* hint was refused. */
+		return LIBMPQ_ERROR_SEEK;
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+
+	/* the page cache keeps the data of a private mapping, so it must be dropped through the file. */
+	if (advice == LIBMPQ_ADVISE_DONTNEED && size > 0 && posix_fadvise(memory->fd, offset, size, POSIX_FADV_DONTNEED) != 0) {
+
+		/* hint was refused. */
+		return LIBMPQ_ERROR_SEEK;
+	}
+#endif
+#endif
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* built-in backend reading files with pread. */
+static const libmpq__io_s io_file = {
+	sizeof(libmpq__io_s),			/* struct_size. */
+	libmpq__io_file_read,			/* read. */
+	libmpq__io_file_size,			/* size. */
+	libmpq__io_file_close,			/* close. */
+	NULL,					/* prefetch. */
+	NULL,					/* read_batch. */
+	NULL,					/* map. */
+	libmpq__io_file_advise			/* advise. */
+};
+
+/* built-in backend reading files with pread and batches with io_uring. */
+static const libmpq__io_s io_file_uring = {
+	sizeof(libmpq__io_s),			/* struct_size. */
+	libmpq__io_file_read,			/* read. */
+	libmpq__io_file_size,			/* size. */
+	libmpq__io_file_close,			/* close. */
+	NULL,					/* prefetch. */
+	libmpq__io_file_read_batch,		/* read_batch. */
+	NULL,					/* map. */
+	libmpq__io_file_advise			/* advise. */
+};
+
+/* built-in backend reading mapped files or caller supplied buffers. */
+static const libmpq__io_s io_memory = {
+	sizeof(libmpq__io_s),			/* struct_size. */
+	libmpq__io_memory_read,			/* read. */
+	libmpq__io_memory_size,			/* size. */
+	libmpq__io_memory_close,		/* close. */
+	NULL,					/* prefetch. */
+	NULL,					/* read_batch. */
+	libmpq__io_memory_map,			/* map. */
+	libmpq__io_memory_advise		/* advise. */
+};
+
+/* this function open a file with pread or, if requested by LIBMPQ_OPEN_MMAP, as memory mapping. */
+int32_t libmpq__io_file_open(const char *filename, uint32_t flags, const libmpq__io_s **io, void **handle) {
+
+	/* some common variables. */
+	io_file_s *file;
+	int fd;
+
+	/* check if file exists and is readable */
+	if ((fd = open(filename, O_RDONLY | O_BINARY)) < 0) {
+
+		/* file could not be opened. */
+		return LIBMPQ_ERROR_OPEN;
+	}
+
+#ifdef HAVE_MMAP
+
+	/* check if we should map the archive into memory. */
+	if ((flags & LIBMPQ_OPEN_MMAP) != 0) {
+
+		/* some common variables. */
+		io_memory_s *memory;
+		struct stat st;
+		void *map;
+
+		/* get the size of the archive file, map the whole file read-only and on failure silently fall back to pread. */
+		if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= (size_t)-1 &&
+		    (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+
+			/* allocate memory for the handle. */
+			if ((memory = calloc(1, sizeof(io_memory_s))) == NULL) {
+
+				/* memory allocation problem. */
+				munmap(map, st.st_size);
+				close(fd);
+				return LIBMPQ_ERROR_MALLOC;
+			}
+
+			/* store mapping for later use, the file descriptor is only kept to drop the page cache. */
+			memory->buffer = map;
+			memory->size   = st.st_size;
+			memory->mapped = TRUE;
+			memory->fd     = fd;
+
+			/* return memory backend. */
+			*io     = &io_memory;
+			*handle = memory;
+
+			/* if no error was found, return zero. */
+			return LIBMPQ_SUCCESS;
+		}
+	}
+#endif
+
+	/* allocate memory for the handle. */
+	if ((file = calloc(1, sizeof(io_file_s))) == NULL) {
+
+		/* memory allocation problem. */
+		close(fd);
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* store file descriptor. */
+	file->fd = fd;
+
+	/* return file backend, with io_uring batches if requested. */
+	*io     = (flags & LIBMPQ_OPEN_URING) != 0 ? &io_file_uring : &io_file;
+	*handle = file;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function open a caller owned buffer, which is never freed or written. */
+int32_t libmpq__io_memory_open(const void *buffer, libmpq__off_t buffer_size, const libmpq__io_s **io, void **handle) {
+
+	/* some common variables. */
+	io_memory_s *memory;
+
+	/* check if we got a buffer. */
+	if (buffer == NULL || buffer_size <= 0) {
+
+		/* nothing to open. */
+		return LIBMPQ_ERROR_OPEN;
+	}
+
+	/* allocate memory for the handle. */
+	if ((memory = calloc(1, sizeof(io_memory_s))) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* store buffer for later use. */
+	memory->buffer = (uint8_t *)buffer;
+	memory->size   = buffer_size;
+	memory->mapped = FALSE;
+	memory->fd     = -1;
+
+	/* return memory backend. */
+	*io     = &io_memory;
+	*handle = memory;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function read a batch of requests, falls back to single reads if the backend has no batch support. */
+int32_t libmpq__io_read_batch(const libmpq__io_s *io, void *handle, libmpq__io_request_s *requests, uint32_t count, libmpq__io_complete_t complete, void *data) {
+
+	/* check if backend can do the whole batch itself. */
+	if (io->read_batch != NULL) {
+
+		/* let the backend schedule the reads. */
+		return io->read_batch(handle, requests, count, complete, data);
+	}
+
+	/* read requests one after another. */
+	return libmpq__io_read_each(io, handle, requests, count, complete, data);
+}
+
+/* this function write size bytes to the current position of fd. */
+int32_t libmpq__io_write(int fd, const void *buffer, libmpq__off_t size) {
+
+	/* some common variables. */
+	ssize_t wb;
+
+	/* write data, the descriptor may accept only a part at once. */
+	while (size > 0) {
+
+		/* write next chunk. */
+		if ((wb = write(fd, buffer, size)) <= 0) {
+
+			/* check if write was interrupted. */
+			if (wb < 0 && errno == EINTR) {
+				continue;
+			}
+
+			/* something on write failed. */
+			return LIBMPQ_ERROR_WRITE;
+		}
+
+		/* move to the remaining part. */
+		buffer  = (const uint8_t *)buffer + wb;
+		size   -= wb;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function copy size bytes from the given storage offset to the current position of fd, without a user space copy where possible. */
+int32_t libmpq__io_copy(const libmpq__io_s *io, void *handle, int fd, libmpq__off_t size, libmpq__off_t offset) {
+
+	/* some common variables. */
+	const void *map;
+	uint8_t *buffer;
+	int32_t result = 0;
+	libmpq__off_t chunk;
+
+	/* check if storage is a file of our own, then the kernel can copy it. */
+	if (io == &io_file || io == &io_file_uring) {
+		libmpq__io_file_copy(handle, fd, &size, &offset);
+	}
+
+	/* check if there is anything left. */
+	if (size == 0) {
+		return LIBMPQ_SUCCESS;
+	}
+
+	/* check if storage is in memory, then it is written straight from there. */
+	if (io->map != NULL && (map = io->map(handle, size, offset)) != NULL) {
+		return libmpq__io_write(fd, map, size);
+	}
+
+	/* take bounded buffer from the scratch buffers of this thread. */
+	if ((buffer = libmpq__scratch_alloc(LIBMPQ_SCRATCH_PACKED, size < LIBMPQ_IO_CHUNK ? size : LIBMPQ_IO_CHUNK)) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* read and write chunk by chunk, so memory use does not grow with the size. */
+	while (result == LIBMPQ_SUCCESS && size > 0) {
+
+		/* read next chunk and write it. */
+		chunk = size < LIBMPQ_IO_CHUNK ? size : LIBMPQ_IO_CHUNK;
+		if ((result = io->read(handle, buffer, chunk, offset)) == LIBMPQ_SUCCESS) {
+			result = libmpq__io_write(fd, buffer, chunk);
+		}
+
+		/* move to the remaining part. */
+		size   -= chunk;
+		offset += chunk;
+	}
+
+	/* release buffer. */
+	libmpq__scratch_free(LIBMPQ_SCRATCH_PACKED, buffer);
+
+	/* return result of the last operation. */
+	return result;
+}
@@ -0,0 +1,69 @@
+/*
+ *  io.h -- header for the built-in archive storage backends.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _IO_H
+#define _IO_H
+
+/* define the largest chunk which is read at once before writing it out. */
+#define LIBMPQ_IO_CHUNK				(256 * 1024)
+
+/* open a file with pread or, if requested by LIBMPQ_OPEN_MMAP, as memory mapping. */
+int32_t libmpq__io_file_open(
+	const char		*filename,
+	uint32_t		flags,
+	const libmpq__io_s	**io,
+	void			**handle
+);
+
+/* open a caller owned buffer, which is never freed or written. */
+int32_t libmpq__io_memory_open(
+	const void		*buffer,
+	libmpq__off_t		buffer_size,
+	const libmpq__io_s	**io,
+	void			**handle
+);
+
+/* read a batch of requests, falls back to single reads if the backend has no batch support. */
+int32_t libmpq__io_read_batch(
+	const libmpq__io_s	*io,
+	void			*handle,
+	libmpq__io_request_s	*requests,
+	uint32_t		count,
+	libmpq__io_complete_t	complete,
+	void			*data
+);
+
+/* write size bytes to the current position of fd. */
+int32_t libmpq__io_write(
+	int			fd,
+	const void		*buffer,
+	libmpq__off_t		size
+);
+
+/* copy size bytes from the given storage offset to the current position of fd, inside the kernel where possible. */
+int32_t libmpq__io_copy(
+	const libmpq__io_s	*io,
+	void			*handle,
+	int			fd,
+	libmpq__off_t		size,
+	libmpq__off_t		offset
+);
+
+#endif						/* _IO_H */
@@ -23,6 +23,7 @@
 #define _MPQ_INTERNAL_H
 
 /* generic includes. */
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -31,6 +32,12 @@
 
 /* define generic mpq archive information. */
 #define LIBMPQ_HEADER				0x1A51504D	/* mpq archive header ('MPQ\x1A') */
+#define LIBMPQ_HEADER_ALIGN			512		/* archive header is always stored at a multiple of this. */
+#define LIBMPQ_SEARCH_CHUNK			(1024 * 1024)	/* bytes read at once while searching the archive header. */
+#define LIBMPQ_OFFSET_CACHE			(1024 * 1024)	/* bytes of packed block offset tables kept after their files were closed. */
+#define LIBMPQ_EXTRACT_BLOCKS			32		/* blocks unpacked at once by one thread while extracting many files. */
+#define LIBMPQ_MERGE_GAP			(64 * 1024)	/* largest gap between files of a batched read which is read over instead of skipped. */
+#define LIBMPQ_MERGE_MAX			(4 * 1024 * 1024)	/* largest merged read of a batched read. */
 
 /* define the known archive versions. */
 #define LIBMPQ_ARCHIVE_VERSION_ONE		0		/* version one used until world of warcraft. */
@@ -105,13 +112,6 @@ typedef struct {
 	uint16_t	offset_high;		/* upper 16 bit of the file offset in archive. */
 } PACK_STRUCT mpq_block_ex_s;
 
-/* file structure used since diablo 1.00 (0x38 bytes). */
-typedef struct {
-	uint32_t	seed;			/* seed used for file decrypt. */
-	uint32_t	*packed_offset;		/* position of each file block (only for packed files). */
-	uint32_t	open_count;		/* number of times it has been opened - used for freeing */
-} PACK_STRUCT mpq_file_s;
-
 /* map structure for valid blocks and hashes (first seen in warcraft 3 archives). */
 typedef struct {
 	uint32_t	block_table_indices;	/* real mapping for file number to block entry. */
@@ -119,11 +119,61 @@ typedef struct {
 } PACK_STRUCT mpq_map_s;
 #include "pack_end.h"
 
+/* file structure used since diablo 1.00, it only lives in memory, so it is not packed. */
+typedef struct mpq_file {
+	uint32_t	seed;			/* seed used for file decrypt. */
+	uint32_t	*packed_offset;		/* position of each file block (only for packed files). */
+	uint32_t	open_count;		/* number of times it has been opened - used for freeing */
+	uint32_t	packed_size;		/* size of the packed block offset table in bytes. */
+	uint32_t	file_number;		/* file the packed block offset table belongs to. */
+	struct mpq_file	*prev;			/* more recently closed file, only used while closed. */
+	struct mpq_file	*next;			/* less recently closed file, only used while closed. */
+} mpq_file_s;
+
+/* cached unpacked block, the data follows directly behind the entry. */
+typedef struct mpq_cache_entry mpq_cache_entry_s;
+
+/* cache of unpacked blocks with least recently used eviction. */
+typedef struct {
+	pthread_mutex_t	lock;			/* protects all members, readers of many threads share the cache. */
+	mpq_cache_entry_s **bucket;		/* hash buckets, entries are chained by file and block number. */
+	uint32_t	bucket_count;		/* number of hash buckets, always a power of two. */
+	mpq_cache_entry_s *head;		/* most recently used entry. */
+	mpq_cache_entry_s *tail;		/* least recently used entry, evicted first. */
+	uint64_t	budget;			/* maximum number of bytes used by entries, zero disables the cache. */
+	uint64_t	used;			/* number of bytes used by entries. */
+	uint64_t	hits;			/* number of blocks taken from the cache. */
+	uint64_t	misses;			/* number of blocks which had to be read and unpacked. */
+} mpq_cache_s;
+
+/* job run by the worker pool, called once for each index. */
+typedef void (*libmpq__pool_job_t)(void *data, uint32_t index);
+
+/* worker threads which unpack the blocks of one file at the same time. */
+typedef struct {
+	pthread_mutex_t	lock;			/* protects all members. */
+	pthread_mutex_t	resize;			/* serializes replacing the worker threads. */
+	pthread_cond_t	work;			/* signalled when a job is posted or the workers have to stop. */
+	pthread_cond_t	done;			/* signalled when the last index of a job finished. */
+	pthread_t	*thread;		/* worker threads. */
+	uint32_t	threads;		/* number of worker threads, zero disables the pool. */
+	uint32_t	stop;			/* workers have to exit. */
+	uint32_t	busy;			/* a job is running, other callers run their jobs themselves meanwhile. */
+	libmpq__pool_job_t job;			/* function of the running job. */
+	void		*data;			/* argument of the running job. */
+	uint32_t	count;			/* number of indices of the running job. */
+	uint32_t	next;			/* next index which is not taken yet. */
+	uint32_t	pending;		/* number of indices which did not finish yet. */
+} mpq_pool_s;
+
 /* archive structure used since diablo 1.00 by blizzard. */
 struct mpq_archive {
 
 	/* generic file information. */
-	FILE		*fp;			/* file handle. */
+	const libmpq__io_s *io;			/* storage backend used for all reads. */
+	libmpq__io_s	io_copy;		/* copy of a caller supplied backend, completed to the current structure size. */
+	void		*io_handle;		/* handle passed to the storage backend. */
+	uint32_t	advice;			/* access hint of the archive, only LIBMPQ_ADVISE_DROP is kept. */
 
 	/* generic size information. */
 	uint32_t	block_size;		/* size of the mpq block. */
@@ -136,6 +186,22 @@ struct mpq_archive {
 	mpq_block_s	*mpq_block;		/* block table. */
 	mpq_block_ex_s	*mpq_block_ex;		/* extended block table. */
 	mpq_file_s	**mpq_file;		/* pointer to the file pointers which are opened. */
+	mpq_file_s	**mpq_file_closed;	/* pointer to the file pointers which are closed but whose tables are kept. */
+	mpq_file_s	*closed_head;		/* most recently closed file. */
+	mpq_file_s	*closed_tail;		/* least recently closed file, its table is freed first. */
+	uint32_t	closed_size;		/* size of all kept packed block offset tables. */
+	pthread_mutex_t	lock;			/* protects opening and closing of mpq_file entries, kept tables and loading of tables. */
+
+	/* sidecar index, the tables above point into it if it is loaded. */
+	uint8_t		*index;			/* index data or NULL if no index is used. */
+	size_t		index_size;		/* size of index data. */
+	uint32_t	index_mapped;		/* index data was mapped and must be unmapped on close. */
+
+	/* unpacked block cache, disabled until a budget is set. */
+	mpq_cache_s	cache;			/* cache shared by all readers of the archive. */
+
+	/* worker threads for unpacking, disabled until a number of threads is set. */
+	mpq_pool_s	pool;			/* pool shared by all readers of the archive. */
 
 	/* non archive structure related members. */
 	mpq_map_s	*mpq_map;		/* map table between valid blocks and hashes. */
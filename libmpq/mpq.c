@@ -26,10 +26,17 @@
 #include "mpq-internal.h"
 
 /* libmpq generic includes. */
+#include "cache.h"
 #include "common.h"
+#include "index.h"
+#include "io.h"
+#include "pool.h"
+#include "scratch.h"
 
 /* generic includes. */
 #include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -57,7 +64,8 @@ static const char *__libmpq_error_strings[] = {
 		"buffer size is to small",
 		"file or block does not exist in archive",
 		"we don't know the decryption seed",
-		"error on unpacking file"
+		"error on unpacking file",
+		"request was cancelled"
 	};
 
 /* this function returns a string message for a return code. */
@@ -70,558 +78,2651 @@ const char *libmpq__strerror(int32_t returncode) {
 	return __libmpq_error_strings[-returncode];
 }
 
-/* this function read a file and verify if it is a valid mpq archive, then it read and decrypt the hash table. */
-int32_t libmpq__archive_open(mpq_archive_s **mpq_archive, const char *mpq_filename, libmpq__off_t archive_offset) {
+/* this function read size bytes from the given absolute offset into buffer. */
+static int32_t libmpq__archive_read(mpq_archive_s *mpq_archive, void *buffer, libmpq__off_t size, libmpq__off_t offset) {
 
-	/* some common variables. */
-	uint32_t i              = 0;
-	uint32_t count          = 0;
-	int32_t result          = 0;
-	uint32_t header_search	= FALSE;
+	/* read through the storage backend. */
+	return mpq_archive->io->read(mpq_archive->io_handle, buffer, size, offset);
+}
 
-	if (archive_offset == -1) {
-		archive_offset = 0;
-		header_search = TRUE;
+/* this function return a pointer into the archive storage or NULL if the range is not available in memory. */
+static uint8_t *libmpq__archive_map(mpq_archive_s *mpq_archive, libmpq__off_t size, libmpq__off_t offset) {
+
+	/* check if storage backend can map data. */
+	if (mpq_archive->io->map == NULL) {
+
+		/* range is not available in memory. */
+		return NULL;
 	}
 
+	/* return pointer into the storage, decompression never writes to its input. */
+	return (uint8_t *)mpq_archive->io->map(mpq_archive->io_handle, size, offset);
+}
+
+/* this function allocate an archive structure with nothing opened yet. */
+static int32_t libmpq__archive_alloc(mpq_archive_s **mpq_archive) {
+
 	if ((*mpq_archive = calloc(1, sizeof(mpq_archive_s))) == NULL) {
 
 		/* archive struct could not be allocated */
 		return LIBMPQ_ERROR_MALLOC;
 	}
 
-	/* check if file exists and is readable */
-	if (((*mpq_archive)->fp = fopen(mpq_filename, "rb")) == NULL) {
+	/* initialize lock for the opened files. */
+	if (pthread_mutex_init(&(*mpq_archive)->lock, NULL) != 0) {
 
-		/* file could not be opened. */
-		result = LIBMPQ_ERROR_OPEN;
-		goto error;
+		/* lock could not be created. */
+		free(*mpq_archive);
+		*mpq_archive = NULL;
+		return LIBMPQ_ERROR_MALLOC;
 	}
 
-	/* assign some default values. */
-	(*mpq_archive)->mpq_header.mpq_magic = 0;
-	(*mpq_archive)->files                = 0;
+	/* initialize disabled block cache. */
+	if (libmpq__cache_init(&(*mpq_archive)->cache) < 0) {
 
-	/* loop through file and search for mpq signature. */
-	while (TRUE) {
+		/* cache lock could not be created. */
+		pthread_mutex_destroy(&(*mpq_archive)->lock);
+		free(*mpq_archive);
+		*mpq_archive = NULL;
+		return LIBMPQ_ERROR_MALLOC;
+	}
 
-		/* reset header values. */
-		(*mpq_archive)->mpq_header.mpq_magic = 0;
+	/* initialize worker pool without threads. */
+	if (libmpq__pool_init(&(*mpq_archive)->pool) < 0) {
 
-		/* seek in file. */
-		if (fseeko((*mpq_archive)->fp, archive_offset, SEEK_SET) < 0) {
+		/* pool locks could not be created. */
+		libmpq__cache_free(&(*mpq_archive)->cache);
+		pthread_mutex_destroy(&(*mpq_archive)->lock);
+		free(*mpq_archive);
+		*mpq_archive = NULL;
+		return LIBMPQ_ERROR_MALLOC;
+	}
 
-			/* seek in file failed. */
-			result = LIBMPQ_ERROR_SEEK;
-			goto error;
-		}
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
 
-		/* read header from file. */
-		if (fread(&(*mpq_archive)->mpq_header, 1, sizeof(mpq_header_s), (*mpq_archive)->fp) != sizeof(mpq_header_s)) {
+/* this function free the archive structure and all tables. */
+static void libmpq__archive_free(mpq_archive_s *mpq_archive) {
 
-			/* no valid mpq archive. */
-			result = LIBMPQ_ERROR_FORMAT;
-			goto error;
-		}
+	/* some common variables. */
+	mpq_file_s *mpq_file;
 
-		/* check if we found a valid mpq header. */
-		if ((*mpq_archive)->mpq_header.mpq_magic == LIBMPQ_HEADER) {
+	/* check if tables point into the sidecar index. */
+	if (mpq_archive->index != NULL) {
 
-			/* check if we process old mpq archive version. */
-			if ((*mpq_archive)->mpq_header.version == LIBMPQ_ARCHIVE_VERSION_ONE) {
+		/* release index with all tables. */
+		libmpq__index_close(mpq_archive);
+	} else {
 
-				/* check if the archive is protected. */
-				if ((*mpq_archive)->mpq_header.header_size != sizeof(mpq_header_s)) {
+		/* free tables. */
+		free(mpq_archive->mpq_map);
+		free(mpq_archive->mpq_hash);
+		free(mpq_archive->mpq_block);
+		free(mpq_archive->mpq_block_ex);
+	}
 
-					/* correct header size. */
-					(*mpq_archive)->mpq_header.header_size = sizeof(mpq_header_s);
-				}
-			}
+	/* free kept packed block offset tables. */
+	while ((mpq_file = mpq_archive->closed_head) != NULL) {
+		mpq_archive->closed_head = mpq_file->next;
+		free(mpq_file->packed_offset);
+		free(mpq_file);
+	}
 
-			/* check if we process new mpq archive version. */
-			if ((*mpq_archive)->mpq_header.version == LIBMPQ_ARCHIVE_VERSION_TWO) {
+	/* free lists, cached blocks and worker threads. */
+	free(mpq_archive->mpq_file);
+	free(mpq_archive->mpq_file_closed);
+	libmpq__cache_free(&mpq_archive->cache);
+	libmpq__pool_free(&mpq_archive->pool);
+	pthread_mutex_destroy(&mpq_archive->lock);
+	free(mpq_archive);
+}
 
-				/* check if the archive is protected. */
-				if ((*mpq_archive)->mpq_header.header_size != sizeof(mpq_header_s) + sizeof(mpq_header_ex_s)) {
+/* this function check if a header candidate found by the search describes tables inside the storage. */
+static uint32_t libmpq__archive_header_valid(mpq_archive_s *mpq_archive, libmpq__off_t archive_offset, libmpq__off_t storage_size) {
 
-					/* correct header size. */
-					(*mpq_archive)->mpq_header.header_size = sizeof(mpq_header_s) + sizeof(mpq_header_ex_s);
-				}
-			}
+	/* some common variables. */
+	mpq_header_s mpq_header;
+	mpq_header_ex_s mpq_header_ex;
+	uint64_t hash_table_end;
+	uint64_t block_table_end;
 
-			/* break the loop, because header was found. */
-			break;
-		}
+	/* read header, a short read means there is no room for an archive. */
+	if (libmpq__archive_read(mpq_archive, &mpq_header, sizeof(mpq_header_s), archive_offset) < 0) {
 
-		/* move to the next possible offset. */
-		if (!header_search) {
+		/* no valid header. */
+		return FALSE;
+	}
 
-			/* no valid mpq archive. */
-			result = LIBMPQ_ERROR_FORMAT;
-			goto error;
-		}
-		archive_offset += 512;
+	/* cleanup extended header, it is only present since version two. */
+	memset(&mpq_header_ex, 0, sizeof(mpq_header_ex_s));
+
+	/* check if we process new mpq archive version. */
+	if (mpq_header.version == LIBMPQ_ARCHIVE_VERSION_TWO &&
+	    libmpq__archive_read(mpq_archive, &mpq_header_ex, sizeof(mpq_header_ex_s), archive_offset + sizeof(mpq_header_s)) < 0) {
+
+		/* no valid header. */
+		return FALSE;
 	}
 
-	/* store block size for later use. */
-	(*mpq_archive)->block_size = 512 << (*mpq_archive)->mpq_header.block_size;
+	/* check if block size fits into 32 bits and if there is a hash table at all. */
+	if (mpq_header.block_size > 22 || mpq_header.hash_table_count == 0) {
 
-	/* store archive offset and size for later use. */
-	(*mpq_archive)->archive_offset = archive_offset;
+		/* no valid header. */
+		return FALSE;
+	}
 
-	/* check if we process new mpq archive version. */
-	if ((*mpq_archive)->mpq_header.version == LIBMPQ_ARCHIVE_VERSION_TWO) {
+	/* compute end of hash and block table, protected archives may lie about header and archive size but not about the tables. */
+	hash_table_end  = archive_offset + mpq_header.hash_table_offset + ((uint64_t)mpq_header_ex.hash_table_offset_high << 32) + (uint64_t)mpq_header.hash_table_count * sizeof(mpq_hash_s);
+	block_table_end = archive_offset + mpq_header.block_table_offset + ((uint64_t)mpq_header_ex.block_table_offset_high << 32) + (uint64_t)mpq_header.block_table_count * sizeof(mpq_block_s);
 
-		/* seek in file. */
-		if (fseeko((*mpq_archive)->fp, sizeof(mpq_header_s) + archive_offset, SEEK_SET) < 0) {
+	/* check if both tables are inside the storage. */
+	if (hash_table_end > (uint64_t)storage_size || block_table_end > (uint64_t)storage_size) {
 
-			/* seek in file failed. */
-			result = LIBMPQ_ERROR_SEEK;
-			goto error;
+		/* no valid header. */
+		return FALSE;
+	}
+
+	/* header looks sane. */
+	return TRUE;
+}
+
+/* this function search the storage for the first valid archive header, which is always aligned to 512 bytes. */
+static int32_t libmpq__archive_search(mpq_archive_s *mpq_archive, libmpq__off_t *archive_offset) {
+
+	/* some common variables. */
+	int32_t result            = 0;
+	uint8_t *chunk_buf        = NULL;
+	uint8_t *chunk;
+	uint32_t magic;
+	libmpq__off_t storage_size = 0;
+	libmpq__off_t chunk_offset;
+	libmpq__off_t chunk_size;
+	libmpq__off_t i;
+
+	/* get size of the storage. */
+	if ((result = mpq_archive->io->size(mpq_archive->io_handle, &storage_size)) < 0) {
+
+		/* size is unknown. */
+		return result;
+	}
+
+	/* loop through the storage in large chunks, each one holds many possible header positions. */
+	for (chunk_offset = 0; chunk_offset + (libmpq__off_t)sizeof(mpq_header_s) <= storage_size; chunk_offset += chunk_size) {
+
+		/* get size of the chunk, it is always a multiple of the header alignment except at the end. */
+		chunk_size = storage_size - chunk_offset < LIBMPQ_SEARCH_CHUNK ? storage_size - chunk_offset : LIBMPQ_SEARCH_CHUNK;
+
+		/* check if chunk can be used directly from memory. */
+		if ((chunk = libmpq__archive_map(mpq_archive, chunk_size, chunk_offset)) == NULL) {
+
+			/* allocate memory for the chunk buffer once. */
+			if (chunk_buf == NULL && (chunk_buf = malloc(LIBMPQ_SEARCH_CHUNK)) == NULL) {
+
+				/* memory allocation problem. */
+				return LIBMPQ_ERROR_MALLOC;
+			}
+
+			/* read chunk with one call instead of one read per possible header. */
+			if ((result = libmpq__archive_read(mpq_archive, chunk_buf, chunk_size, chunk_offset)) < 0) {
+
+				/* free buffer. */
+				free(chunk_buf);
+
+				/* something on read failed. */
+				return result;
+			}
+
+			/* use the buffered chunk. */
+			chunk = chunk_buf;
 		}
 
-		/* read header from file. */
-		if (fread(&(*mpq_archive)->mpq_header_ex, 1, sizeof(mpq_header_ex_s), (*mpq_archive)->fp) != sizeof(mpq_header_ex_s)) {
+		/* a header can only start at aligned positions, so only one word per 512 bytes has to be compared. */
+		for (i = 0; i + (libmpq__off_t)sizeof(mpq_header_s) <= chunk_size; i += LIBMPQ_HEADER_ALIGN) {
 
-			/* no valid mpq archive. */
-			result = LIBMPQ_ERROR_FORMAT;
-			goto error;
+			/* fetch possible signature without alignment requirement. */
+			memcpy(&magic, chunk + i, sizeof(uint32_t));
+
+			/* check if we found a candidate which describes tables inside the storage. */
+			if (magic == LIBMPQ_HEADER &&
+			    libmpq__archive_header_valid(mpq_archive, chunk_offset + i, storage_size)) {
+
+				/* free buffer. */
+				free(chunk_buf);
+
+				/* return archive offset. */
+				*archive_offset = chunk_offset + i;
+
+				/* if no error was found, return zero. */
+				return LIBMPQ_SUCCESS;
+			}
 		}
 	}
 
-	/* allocate memory for the block table, hash table, file and block table to file mapping. */
-	if (((*mpq_archive)->mpq_block    = calloc((*mpq_archive)->mpq_header.block_table_count, sizeof(mpq_block_s))) == NULL ||
-	    ((*mpq_archive)->mpq_block_ex = calloc((*mpq_archive)->mpq_header.block_table_count, sizeof(mpq_block_ex_s))) == NULL ||
-	    ((*mpq_archive)->mpq_hash     = calloc((*mpq_archive)->mpq_header.hash_table_count,  sizeof(mpq_hash_s))) == NULL ||
-	    ((*mpq_archive)->mpq_file     = calloc((*mpq_archive)->mpq_header.block_table_count, sizeof(mpq_file_s))) == NULL ||
-	    ((*mpq_archive)->mpq_map      = calloc((*mpq_archive)->mpq_header.block_table_count, sizeof(mpq_map_s))) == NULL) {
+	/* free buffer. */
+	free(chunk_buf);
 
-		/* memory allocation problem. */
-		result = LIBMPQ_ERROR_MALLOC;
+	/* no valid mpq archive. */
+	return LIBMPQ_ERROR_FORMAT;
+}
+
+/* this function read and decrypt the hash table, if it is not loaded yet. */
+static int32_t libmpq__archive_load_hash(mpq_archive_s *mpq_archive) {
+
+	/* some common variables. */
+	int32_t result          = LIBMPQ_SUCCESS;
+	uint32_t *buffer        = NULL;
+	mpq_hash_s *mpq_hash    = NULL;
+
+	/* check if table is already loaded, which is the common case. */
+	if (__atomic_load_n(&mpq_archive->mpq_hash, __ATOMIC_ACQUIRE) != NULL) {
+		return LIBMPQ_SUCCESS;
+	}
+
+	/* lock the archive, other threads may load the table at the same time. */
+	pthread_mutex_lock(&mpq_archive->lock);
+
+	/* check if another thread loaded the table meanwhile. */
+	if (mpq_archive->mpq_hash != NULL) {
 		goto error;
 	}
 
-	/* seek in file. */
-	if (fseeko((*mpq_archive)->fp, (*mpq_archive)->mpq_header.hash_table_offset + (((long long)((*mpq_archive)->mpq_header_ex.hash_table_offset_high)) << 32) + (*mpq_archive)->archive_offset, SEEK_SET) < 0) {
+	/* allocate memory for the hash table, as words so it can be decrypted in place. */
+	if ((buffer = calloc(mpq_archive->mpq_header.hash_table_count, sizeof(mpq_hash_s))) == NULL) {
 
-		/* seek in file failed. */
-		result = LIBMPQ_ERROR_SEEK;
+		/* memory allocation problem. */
+		result = LIBMPQ_ERROR_MALLOC;
 		goto error;
 	}
 
 	/* read the hash table into the buffer. */
-	if (fread((*mpq_archive)->mpq_hash, 1, (*mpq_archive)->mpq_header.hash_table_count * sizeof(mpq_hash_s), (*mpq_archive)->fp) != (*mpq_archive)->mpq_header.hash_table_count * sizeof(mpq_hash_s)) {
+	if ((result = libmpq__archive_read(mpq_archive, buffer, mpq_archive->mpq_header.hash_table_count * sizeof(mpq_hash_s), mpq_archive->mpq_header.hash_table_offset + (((long long)(mpq_archive->mpq_header_ex.hash_table_offset_high)) << 32) + mpq_archive->archive_offset)) < 0) {
 
 		/* something on read failed. */
-		result = LIBMPQ_ERROR_READ;
 		goto error;
 	}
 
 	/* decrypt the hashtable. */
-	libmpq__decrypt_block((uint32_t *)((*mpq_archive)->mpq_hash), (*mpq_archive)->mpq_header.hash_table_count * sizeof(mpq_hash_s), libmpq__hash_string("(hash table)", 0x300));
+	libmpq__decrypt_block(buffer, mpq_archive->mpq_header.hash_table_count * sizeof(mpq_hash_s), libmpq__hash_string("(hash table)", 0x300));
+	mpq_hash = (mpq_hash_s *)buffer;
+	buffer   = NULL;
+
+	/* publish table, lock-free readers see it only after it is complete. */
+	__atomic_store_n(&mpq_archive->mpq_hash, mpq_hash, __ATOMIC_RELEASE);
+	mpq_hash = NULL;
+
+error:
+
+	/* unlock the archive. */
+	pthread_mutex_unlock(&mpq_archive->lock);
+
+	/* free unused table. */
+	free(buffer);
+	free(mpq_hash);
+
+	/* return error constant or zero. */
+	return result;
+}
+
+/* this function read and decrypt the block table and build the file map, if they are not loaded yet. */
+static int32_t libmpq__archive_load_block(mpq_archive_s *mpq_archive) {
+
+	/* some common variables. */
+	uint32_t i              = 0;
+	uint32_t count          = 0;
+	int32_t result          = LIBMPQ_SUCCESS;
+	uint32_t *buffer        = NULL;
+	mpq_block_s *mpq_block  = NULL;
+	mpq_block_ex_s *mpq_block_ex = NULL;
+	mpq_file_s **mpq_file   = NULL;
+	mpq_file_s **mpq_file_closed = NULL;
+	mpq_map_s *mpq_map      = NULL;
+
+	/* check if table is already loaded, which is the common case. */
+	if (__atomic_load_n(&mpq_archive->mpq_block, __ATOMIC_ACQUIRE) != NULL) {
+		return LIBMPQ_SUCCESS;
+	}
 
-	/* seek in file. */
-	if (fseeko((*mpq_archive)->fp, (*mpq_archive)->mpq_header.block_table_offset + (((long long)((*mpq_archive)->mpq_header_ex.block_table_offset_high)) << 32) + (*mpq_archive)->archive_offset, SEEK_SET) < 0) {
+	/* lock the archive, other threads may load the table at the same time. */
+	pthread_mutex_lock(&mpq_archive->lock);
 
-		/* seek in file failed. */
-		result = LIBMPQ_ERROR_SEEK;
+	/* check if another thread loaded the table meanwhile. */
+	if (mpq_archive->mpq_block != NULL) {
+		goto error;
+	}
+
+	/* allocate memory for the block table, file and block table to file mapping. */
+	if ((buffer       = calloc(mpq_archive->mpq_header.block_table_count, sizeof(mpq_block_s))) == NULL ||
+	    (mpq_block_ex = calloc(mpq_archive->mpq_header.block_table_count, sizeof(mpq_block_ex_s))) == NULL ||
+	    (mpq_file     = calloc(mpq_archive->mpq_header.block_table_count, sizeof(mpq_file_s))) == NULL ||
+	    (mpq_file_closed = calloc(mpq_archive->mpq_header.block_table_count, sizeof(mpq_file_s *))) == NULL ||
+	    (mpq_map      = calloc(mpq_archive->mpq_header.block_table_count, sizeof(mpq_map_s))) == NULL) {
+
+		/* memory allocation problem. */
+		result = LIBMPQ_ERROR_MALLOC;
 		goto error;
 	}
 
 	/* read the block table into the buffer. */
-	if (fread((*mpq_archive)->mpq_block, 1, (*mpq_archive)->mpq_header.block_table_count * sizeof(mpq_block_s), (*mpq_archive)->fp) != (*mpq_archive)->mpq_header.block_table_count * sizeof(mpq_block_s)) {
+	if ((result = libmpq__archive_read(mpq_archive, buffer, mpq_archive->mpq_header.block_table_count * sizeof(mpq_block_s), mpq_archive->mpq_header.block_table_offset + (((long long)(mpq_archive->mpq_header_ex.block_table_offset_high)) << 32) + mpq_archive->archive_offset)) < 0) {
 
 		/* something on read failed. */
-		result = LIBMPQ_ERROR_READ;
 		goto error;
 	}
 
 	/* decrypt block table. */
-	libmpq__decrypt_block((uint32_t *)((*mpq_archive)->mpq_block), (*mpq_archive)->mpq_header.block_table_count * sizeof(mpq_block_s), libmpq__hash_string("(block table)", 0x300));
+	libmpq__decrypt_block(buffer, mpq_archive->mpq_header.block_table_count * sizeof(mpq_block_s), libmpq__hash_string("(block table)", 0x300));
+	mpq_block = (mpq_block_s *)buffer;
+	buffer    = NULL;
 
 	/* check if extended block table is present, regardless of version 2 it is only present in archives > 4GB. */
-	if ((*mpq_archive)->mpq_header_ex.extended_offset > 0) {
-
-		/* seek in file. */
-		if (fseeko((*mpq_archive)->fp, (*mpq_archive)->mpq_header_ex.extended_offset + archive_offset, SEEK_SET) < 0) {
-
-			/* seek in file failed. */
-			result = LIBMPQ_ERROR_SEEK;
-			goto error;
-		}
+	if (mpq_archive->mpq_header_ex.extended_offset > 0) {
 
 		/* read header from file. */
-		if (fread((*mpq_archive)->mpq_block_ex, 1, (*mpq_archive)->mpq_header.block_table_count * sizeof(mpq_block_ex_s), (*mpq_archive)->fp) != (*mpq_archive)->mpq_header.block_table_count * sizeof(mpq_block_ex_s)) {
+		if ((result = libmpq__archive_read(mpq_archive, mpq_block_ex, mpq_archive->mpq_header.block_table_count * sizeof(mpq_block_ex_s), mpq_archive->mpq_header_ex.extended_offset + mpq_archive->archive_offset)) < 0) {
 
 			/* no valid mpq archive. */
-			result = LIBMPQ_ERROR_FORMAT;
+			result = result == LIBMPQ_ERROR_SEEK ? result : LIBMPQ_ERROR_FORMAT;
 			goto error;
 		}
 	}
 
 	/* loop through all files in mpq archive and check if they are valid. */
-	for (i = 0; i < (*mpq_archive)->mpq_header.block_table_count; i++) {
+	for (i = 0; i < mpq_archive->mpq_header.block_table_count; i++) {
 
 		/* save block difference between valid and invalid blocks. */
-		(*mpq_archive)->mpq_map[i].block_table_diff = i - count;
+		mpq_map[i].block_table_diff = i - count;
 
 		/* check if file exists, sizes and offsets are correct. */
-		if (((*mpq_archive)->mpq_block[i].flags & LIBMPQ_FLAG_EXISTS) == 0) {
+		if ((mpq_block[i].flags & LIBMPQ_FLAG_EXISTS) == 0) {
 
 			/* file does not exist, so nothing to do with that block. */
 			continue;
 		}
 
 		/* create final indices tables. */
-		(*mpq_archive)->mpq_map[count].block_table_indices = i;
+		mpq_map[count].block_table_indices = i;
 
 		/* increase file counter. */
 		count++;
 	}
 
-	/* save the number of files. */
-	(*mpq_archive)->files = count;
-
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
+	/* save the number of files and the tables. */
+	mpq_archive->files        = count;
+	mpq_archive->mpq_block_ex = mpq_block_ex;
+	mpq_archive->mpq_file     = mpq_file;
+	mpq_archive->mpq_file_closed = mpq_file_closed;
+	mpq_archive->mpq_map      = mpq_map;
+
+	/* publish block table last, lock-free readers see the others only after it. */
+	__atomic_store_n(&mpq_archive->mpq_block, mpq_block, __ATOMIC_RELEASE);
+	mpq_block    = NULL;
+	mpq_block_ex = NULL;
+	mpq_file     = NULL;
+	mpq_file_closed = NULL;
+	mpq_map      = NULL;
 
 error:
-	if ((*mpq_archive)->fp)
-		fclose((*mpq_archive)->fp);
 
-	free((*mpq_archive)->mpq_map);
-	free((*mpq_archive)->mpq_file);
-	free((*mpq_archive)->mpq_hash);
-	free((*mpq_archive)->mpq_block);
-	free((*mpq_archive)->mpq_block_ex);
-	free(*mpq_archive);
+	/* unlock the archive. */
+	pthread_mutex_unlock(&mpq_archive->lock);
 
-	*mpq_archive = NULL;
+	/* free unused tables. */
+	free(buffer);
+	free(mpq_block);
+	free(mpq_block_ex);
+	free(mpq_file);
+	free(mpq_file_closed);
+	free(mpq_map);
 
+	/* return error constant or zero. */
 	return result;
 }
 
-/* this function close the file descriptor, free the decryption buffer and the file list. */
-int32_t libmpq__archive_close(mpq_archive_s *mpq_archive) {
-
-	/* try to close the file */
-	if ((fclose(mpq_archive->fp)) < 0) {
+/* this function verify if the opened data is a valid mpq archive, then it read and decrypt the hash and block table unless they are loaded on first use. */
+static int32_t libmpq__archive_load(mpq_archive_s *mpq_archive, libmpq__off_t archive_offset, uint32_t flags) {
 
-		/* don't free anything here, so the caller can try calling us
-		 * again.
-		 */
-		return LIBMPQ_ERROR_CLOSE;
-	}
-
-	/* free header, tables and list. */
-	free(mpq_archive->mpq_map);
-	free(mpq_archive->mpq_file);
-	free(mpq_archive->mpq_hash);
-	free(mpq_archive->mpq_block);
-	free(mpq_archive->mpq_block_ex);
-	free(mpq_archive);
+	/* some common variables. */
+	int32_t result          = 0;
 
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
-}
+	/* assign some default values. */
+	mpq_archive->mpq_header.mpq_magic = 0;
+	mpq_archive->files                = 0;
 
-/* this function return the packed size of all files in the archive. */
-int32_t libmpq__archive_size_packed(mpq_archive_s *mpq_archive, libmpq__off_t *packed_size) {
+	/* check if we have to search for the archive header. */
+	if (archive_offset == -1) {
 
-	/* some common variables. */
-	uint32_t i;
+		/* scan the storage for the first valid header. */
+		if ((result = libmpq__archive_search(mpq_archive, &archive_offset)) < 0) {
 
-	/* loop through all files in archive and count packed size. */
-	for (i = 0; i < mpq_archive->files; i++) {
-		*packed_size += mpq_archive->mpq_block[mpq_archive->mpq_map[i].block_table_indices].packed_size;
+			/* no valid mpq archive. */
+			return result;
+		}
 	}
 
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
-}
+	/* read header from file. */
+	if ((result = libmpq__archive_read(mpq_archive, &mpq_archive->mpq_header, sizeof(mpq_header_s), archive_offset)) < 0) {
 
-/* this function return the unpacked size of all files in the archive. */
-int32_t libmpq__archive_size_unpacked(mpq_archive_s *mpq_archive, libmpq__off_t *unpacked_size) {
+		/* no valid mpq archive. */
+		return result == LIBMPQ_ERROR_SEEK ? result : LIBMPQ_ERROR_FORMAT;
+	}
 
-	/* some common variables. */
-	uint32_t i;
+	/* check if we found a valid mpq header. */
+	if (mpq_archive->mpq_header.mpq_magic != LIBMPQ_HEADER) {
 
-	/* loop through all files in archive and count unpacked size. */
-	for (i = 0; i < mpq_archive->files; i++) {
-		*unpacked_size += mpq_archive->mpq_block[mpq_archive->mpq_map[i].block_table_indices].unpacked_size;
+		/* no valid mpq archive. */
+		return LIBMPQ_ERROR_FORMAT;
 	}
 
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
-}
+	/* check if we process old mpq archive version. */
+	if (mpq_archive->mpq_header.version == LIBMPQ_ARCHIVE_VERSION_ONE) {
 
-/* this function return the archive offset (beginning of archive in file). */
-int32_t libmpq__archive_offset(mpq_archive_s *mpq_archive, libmpq__off_t *offset) {
+		/* check if the archive is protected. */
+		if (mpq_archive->mpq_header.header_size != sizeof(mpq_header_s)) {
 
-	/* return archive offset. */
-	*offset = mpq_archive->archive_offset;
+			/* correct header size. */
+			mpq_archive->mpq_header.header_size = sizeof(mpq_header_s);
+		}
+	}
 
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
-}
+	/* check if we process new mpq archive version. */
+	if (mpq_archive->mpq_header.version == LIBMPQ_ARCHIVE_VERSION_TWO) {
 
-/* this function return the archive offset. */
-int32_t libmpq__archive_version(mpq_archive_s *mpq_archive, uint32_t *version) {
+		/* check if the archive is protected. */
+		if (mpq_archive->mpq_header.header_size != sizeof(mpq_header_s) + sizeof(mpq_header_ex_s)) {
 
-	/* return archive version. */
-	*version = mpq_archive->mpq_header.version + 1;
+			/* correct header size. */
+			mpq_archive->mpq_header.header_size = sizeof(mpq_header_s) + sizeof(mpq_header_ex_s);
+		}
+	}
 
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
-}
+	/* store block size for later use. */
+	mpq_archive->block_size = 512 << mpq_archive->mpq_header.block_size;
 
-/* this function return the number of valid files in archive. */
-int32_t libmpq__archive_files(mpq_archive_s *mpq_archive, uint32_t *files) {
+	/* store archive offset and size for later use. */
+	mpq_archive->archive_offset = archive_offset;
 
-	/* return archive version. */
-	*files = mpq_archive->files;
+	/* check if we process new mpq archive version. */
+	if (mpq_archive->mpq_header.version == LIBMPQ_ARCHIVE_VERSION_TWO) {
 
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
-}
+		/* read header from file. */
+		if ((result = libmpq__archive_read(mpq_archive, &mpq_archive->mpq_header_ex, sizeof(mpq_header_ex_s), sizeof(mpq_header_s) + archive_offset)) < 0) {
 
-#define CHECK_FILE_NUM(file_number, mpq_archive) \
-	if (file_number < 0 || file_number > mpq_archive->files - 1) { \
-		return LIBMPQ_ERROR_EXIST; \
+			/* no valid mpq archive. */
+			return result == LIBMPQ_ERROR_SEEK ? result : LIBMPQ_ERROR_FORMAT;
+		}
 	}
 
-#define CHECK_BLOCK_NUM(block_number, mpq_archive) \
-	if (block_number < 0 || block_number >= ((mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_SINGLE) != 0 ? 1 : (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].unpacked_size + mpq_archive->block_size - 1) / mpq_archive->block_size)) { \
-		return LIBMPQ_ERROR_EXIST; \
-	}
+	/* check if tables should be loaded on first use. */
+	if ((flags & LIBMPQ_OPEN_LAZY) != 0) {
 
-/* this function return the packed size of the given files in the archive. */
-int32_t libmpq__file_size_packed(mpq_archive_s *mpq_archive, uint32_t file_number, libmpq__off_t *packed_size) {
+		/* if no error was found, return zero. */
+		return LIBMPQ_SUCCESS;
+	}
 
-	/* check if given file number is not out of range. */
-	CHECK_FILE_NUM(file_number, mpq_archive)
+	/* read and decrypt both tables now. */
+	if ((result = libmpq__archive_load_hash(mpq_archive)) < 0 ||
+	    (result = libmpq__archive_load_block(mpq_archive)) < 0) {
 
-	/* get the packed size of file. */
-	*packed_size = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].packed_size;
+		/* something on reading tables failed. */
+		return result;
+	}
 
 	/* if no error was found, return zero. */
 	return LIBMPQ_SUCCESS;
 }
 
-/* this function return the unpacked size of the given file in the archive. */
-int32_t libmpq__file_size_unpacked(mpq_archive_s *mpq_archive, uint32_t file_number, libmpq__off_t *unpacked_size) {
+/* this function read a file and verify if it is a valid mpq archive, then it read and decrypt the hash table. */
+int32_t libmpq__archive_open(mpq_archive_s **mpq_archive, const char *mpq_filename, libmpq__off_t archive_offset) {
 
-	/* check if given file number is not out of range. */
-	CHECK_FILE_NUM(file_number, mpq_archive)
+	/* open archive with default flags. */
+	return libmpq__archive_open_flags(mpq_archive, mpq_filename, archive_offset, 0);
+}
 
-	/* get the unpacked size of file. */
-	*unpacked_size = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].unpacked_size;
+/* this function read a file and verify if it is a valid mpq archive using the given open flags. */
+int32_t libmpq__archive_open_flags(mpq_archive_s **mpq_archive, const char *mpq_filename, libmpq__off_t archive_offset, uint32_t flags) {
 
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
-}
+	/* some common variables. */
+	int32_t result = 0;
+	const libmpq__io_s *io;
+	void *handle;
 
-/* this function return the file offset (beginning of file in archive). */
-int32_t libmpq__file_offset(mpq_archive_s *mpq_archive, uint32_t file_number, libmpq__off_t *offset) {
+	/* open file with the built-in file or memory mapping backend. */
+	if ((result = libmpq__io_file_open(mpq_filename, flags, &io, &handle)) < 0) {
 
-	/* check if given file number is not out of range. */
-	CHECK_FILE_NUM(file_number, mpq_archive)
+		/* file could not be opened. */
+		*mpq_archive = NULL;
+		return result;
+	}
 
-	/* return file offset relative to archive start. */
-	*offset = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].offset + (((long long)mpq_archive->mpq_block_ex[mpq_archive->mpq_map[file_number].block_table_indices].offset_high) << 32);
+	/* open archive on top of the backend. */
+	if ((result = libmpq__archive_open_io(mpq_archive, io, handle, archive_offset, flags)) < 0) {
 
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
+		/* close the backend, on failure it still belongs to us. */
+		io->close(handle);
+	}
+
+	/* return result. */
+	return result;
 }
 
-/* this function return the number of blocks for the given file in the archive. */
-int32_t libmpq__file_blocks(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t *blocks) {
+/* this function open an archive and take its tables from the sidecar index, the index is rebuilt if it is missing or stale. */
+int32_t libmpq__archive_open_index(mpq_archive_s **mpq_archive, const char *mpq_filename, const char *index_filename, libmpq__off_t archive_offset, uint32_t flags) {
 
-	/* check if given file number is not out of range. */
-	CHECK_FILE_NUM(file_number, mpq_archive)
+	/* some common variables. */
+	int32_t result = 0;
+	const libmpq__io_s *io;
+	void *handle;
+	struct stat st;
 
-	/* return the number of blocks for the given file. */
-	*blocks = (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_SINGLE) != 0 ? 1 : (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].unpacked_size + mpq_archive->block_size - 1) / mpq_archive->block_size;
+	/* get modification time of the archive, the index is only valid for this one. */
+	if (stat(mpq_filename, &st) < 0) {
+
+		/* file could not be opened. */
+		*mpq_archive = NULL;
+		return LIBMPQ_ERROR_OPEN;
+	}
+
+	/* open file with the built-in file or memory mapping backend. */
+	if ((result = libmpq__io_file_open(mpq_filename, flags, &io, &handle)) < 0) {
+
+		/* file could not be opened. */
+		*mpq_archive = NULL;
+		return result;
+	}
+
+	/* allocate archive structure. */
+	if ((result = libmpq__archive_alloc(mpq_archive)) < 0) {
+
+		/* close the backend, on failure it still belongs to us. */
+		io->close(handle);
+		return result;
+	}
+
+	/* store backend for later use. */
+	(*mpq_archive)->io        = io;
+	(*mpq_archive)->io_handle = handle;
+
+	/* check if index matches, then nothing has to be read or decrypted from the archive. */
+	if (libmpq__index_load(*mpq_archive, index_filename, archive_offset, st.st_mtime) == LIBMPQ_SUCCESS) {
+
+		/* if no error was found, return zero. */
+		return LIBMPQ_SUCCESS;
+	}
+
+	/* read header and tables, the index needs all of them. */
+	if ((result = libmpq__archive_load(*mpq_archive, archive_offset, flags & ~LIBMPQ_OPEN_LAZY)) < 0) {
+
+		/* free archive and close the backend. */
+		libmpq__archive_free(*mpq_archive);
+		io->close(handle);
+
+		*mpq_archive = NULL;
+
+		return result;
+	}
+
+	/* rebuild index, it is only a cache, so errors like a read-only directory are ignored. */
+	libmpq__index_save(*mpq_archive, index_filename, archive_offset, st.st_mtime);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function verify if the given buffer is a valid mpq archive, all reads are done in place from the buffer. */
+int32_t libmpq__archive_open_memory(mpq_archive_s **mpq_archive, const void *buffer, libmpq__off_t buffer_size, libmpq__off_t archive_offset) {
+
+	/* some common variables. */
+	int32_t result = 0;
+	const libmpq__io_s *io;
+	void *handle;
+
+	/* wrap the buffer with the built-in memory backend. */
+	if ((result = libmpq__io_memory_open(buffer, buffer_size, &io, &handle)) < 0) {
+
+		/* nothing to open. */
+		*mpq_archive = NULL;
+		return result;
+	}
+
+	/* open archive on top of the backend. */
+	if ((result = libmpq__archive_open_io(mpq_archive, io, handle, archive_offset, 0)) < 0) {
+
+		/* close the backend, the buffer still belongs to the caller. */
+		io->close(handle);
+	}
+
+	/* return result. */
+	return result;
+}
+
+/* this function verify if the storage behind the given backend is a valid mpq archive. */
+int32_t libmpq__archive_open_io(mpq_archive_s **mpq_archive, const libmpq__io_s *io, void *handle, libmpq__off_t archive_offset, uint32_t flags) {
+
+	/* some common variables. */
+	int32_t result = 0;
+
+	/* check if the structure covers the mandatory functions and if they are available. */
+	if (io == NULL || io->struct_size < offsetof(libmpq__io_s, prefetch) || io->read == NULL || io->size == NULL || io->close == NULL) {
+
+		/* storage cannot be used. */
+		*mpq_archive = NULL;
+		return LIBMPQ_ERROR_OPEN;
+	}
+
+	/* allocate archive structure. */
+	if ((result = libmpq__archive_alloc(mpq_archive)) < 0) {
+
+		/* archive struct could not be allocated */
+		return result;
+	}
+
+	/* copy backend, members behind the size known to the caller stay NULL. */
+	memcpy(&(*mpq_archive)->io_copy, io, io->struct_size < sizeof(libmpq__io_s) ? io->struct_size : sizeof(libmpq__io_s));
+	(*mpq_archive)->io_copy.struct_size = sizeof(libmpq__io_s);
+
+	/* store backend for later use. */
+	(*mpq_archive)->io        = &(*mpq_archive)->io_copy;
+	(*mpq_archive)->io_handle = handle;
+
+	/* read header and tables. */
+	if ((result = libmpq__archive_load(*mpq_archive, archive_offset, flags)) < 0) {
+
+		/* free archive, the backend still belongs to the caller. */
+		libmpq__archive_free(*mpq_archive);
+
+		*mpq_archive = NULL;
+
+		return result;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function close the file descriptor, free the decryption buffer and the file list. */
+int32_t libmpq__archive_close(mpq_archive_s *mpq_archive) {
+
+	/* try to close the storage backend */
+	if (mpq_archive->io->close(mpq_archive->io_handle) < 0) {
+
+		/* don't free anything here, so the caller can try calling us
+		 * again.
+		 */
+		return LIBMPQ_ERROR_CLOSE;
+	}
+
+	/* free header, tables and list. */
+	libmpq__archive_free(mpq_archive);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the packed size of all files in the archive. */
+int32_t libmpq__archive_size_packed(mpq_archive_s *mpq_archive, libmpq__off_t *packed_size) {
+
+	/* some common variables. */
+	uint32_t i;
+	int32_t result;
+
+	/* load block table on first use. */
+	if ((result = libmpq__archive_load_block(mpq_archive)) < 0) {
+
+		/* something on reading block table failed. */
+		return result;
+	}
+
+	/* loop through all files in archive and count packed size. */
+	for (i = 0; i < mpq_archive->files; i++) {
+		*packed_size += mpq_archive->mpq_block[mpq_archive->mpq_map[i].block_table_indices].packed_size;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the unpacked size of all files in the archive. */
+int32_t libmpq__archive_size_unpacked(mpq_archive_s *mpq_archive, libmpq__off_t *unpacked_size) {
+
+	/* some common variables. */
+	uint32_t i;
+	int32_t result;
+
+	/* load block table on first use. */
+	if ((result = libmpq__archive_load_block(mpq_archive)) < 0) {
+
+		/* something on reading block table failed. */
+		return result;
+	}
+
+	/* loop through all files in archive and count unpacked size. */
+	for (i = 0; i < mpq_archive->files; i++) {
+		*unpacked_size += mpq_archive->mpq_block[mpq_archive->mpq_map[i].block_table_indices].unpacked_size;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the archive offset (beginning of archive in file). */
+int32_t libmpq__archive_offset(mpq_archive_s *mpq_archive, libmpq__off_t *offset) {
+
+	/* return archive offset. */
+	*offset = mpq_archive->archive_offset;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the archive offset. */
+int32_t libmpq__archive_version(mpq_archive_s *mpq_archive, uint32_t *version) {
+
+	/* return archive version. */
+	*version = mpq_archive->mpq_header.version + 1;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the number of valid files in archive. */
+int32_t libmpq__archive_files(mpq_archive_s *mpq_archive, uint32_t *files) {
+
+	/* some common variables. */
+	int32_t result;
+
+	/* load block table on first use. */
+	if ((result = libmpq__archive_load_block(mpq_archive)) < 0) {
+
+		/* something on reading block table failed. */
+		return result;
+	}
+
+	/* return archive version. */
+	*files = mpq_archive->files;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function set the number of bytes used to cache unpacked blocks, zero disables the cache. */
+int32_t libmpq__archive_cache(mpq_archive_s *mpq_archive, libmpq__off_t cache_size) {
+
+	/* check if size is valid. */
+	if (cache_size < 0) {
+
+		/* negative budget makes no sense. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* resize cache and evict blocks which do not fit anymore. */
+	return libmpq__cache_budget(&mpq_archive->cache, cache_size, mpq_archive->block_size);
+}
+
+/* this function return the hit and miss counters of the block cache and the number of bytes it uses. */
+int32_t libmpq__archive_cache_stats(mpq_archive_s *mpq_archive, uint64_t *hits, uint64_t *misses, libmpq__off_t *cache_used) {
+
+	/* some common variables. */
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	uint64_t cache_bytes;
+
+	/* fetch all counters at once. */
+	libmpq__cache_stats(&mpq_archive->cache, &cache_hits, &cache_misses, &cache_bytes);
+
+	/* check for null pointers. */
+	if (hits != NULL) {
+		*hits = cache_hits;
+	}
+	if (misses != NULL) {
+		*misses = cache_misses;
+	}
+	if (cache_used != NULL) {
+		*cache_used = cache_bytes;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function set the number of worker threads which unpack the blocks of one file at the same time. */
+int32_t libmpq__archive_threads(mpq_archive_s *mpq_archive, uint32_t threads) {
+
+	/* check if number of threads is sane. */
+	if (threads > LIBMPQ_POOL_THREADS_MAX) {
+
+		/* more threads than any machine has cores. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* replace worker threads, the reading thread helps them, so one thread less is started. */
+	return libmpq__pool_threads(&mpq_archive->pool, threads > 1 ? threads - 1 : 0);
+}
+
+#define CHECK_FILE_NUM(file_number, mpq_archive) \
+	{ \
+		int32_t load_result; \
+		if ((load_result = libmpq__archive_load_block(mpq_archive)) < 0) { \
+			return load_result; \
+		} \
+	} \
+	if (file_number < 0 || file_number > mpq_archive->files - 1) { \
+		return LIBMPQ_ERROR_EXIST; \
+	}
+
+#define CHECK_BLOCK_NUM(block_number, mpq_archive) \
+	if (block_number < 0 || block_number >= ((mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_SINGLE) != 0 ? 1 : (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].unpacked_size + mpq_archive->block_size - 1) / mpq_archive->block_size)) { \
+		return LIBMPQ_ERROR_EXIST; \
+	}
+
+/* this function return the packed size of the given files in the archive. */
+int32_t libmpq__file_size_packed(mpq_archive_s *mpq_archive, uint32_t file_number, libmpq__off_t *packed_size) {
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* get the packed size of file. */
+	*packed_size = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].packed_size;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the unpacked size of the given file in the archive. */
+int32_t libmpq__file_size_unpacked(mpq_archive_s *mpq_archive, uint32_t file_number, libmpq__off_t *unpacked_size) {
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* get the unpacked size of file. */
+	*unpacked_size = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].unpacked_size;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the file offset (beginning of file in archive). */
+int32_t libmpq__file_offset(mpq_archive_s *mpq_archive, uint32_t file_number, libmpq__off_t *offset) {
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* return file offset relative to archive start. */
+	*offset = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].offset + (((long long)mpq_archive->mpq_block_ex[mpq_archive->mpq_map[file_number].block_table_indices].offset_high) << 32);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the number of blocks for the given file in the archive. */
+int32_t libmpq__file_blocks(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t *blocks) {
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* return the number of blocks for the given file. */
+	*blocks = (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_SINGLE) != 0 ? 1 : (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].unpacked_size + mpq_archive->block_size - 1) / mpq_archive->block_size;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return if the file is encrypted or not. */
+int32_t libmpq__file_encrypted(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t *encrypted) {
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* return the encryption status of file. */
+	*encrypted = (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_ENCRYPTED) != 0 ? TRUE : FALSE;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return if the file is compressed or not. */
+int32_t libmpq__file_compressed(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t *compressed) {
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* return the compression status of file. */
+	*compressed = (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_COMPRESS_MULTI) != 0 ? TRUE : FALSE;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return if the file is imploded or not. */
+int32_t libmpq__file_imploded(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t *imploded) {
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* return the implosion status of file. */
+	*imploded = (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_COMPRESS_PKZIP) != 0 ? TRUE : FALSE;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return filenumber by the given name. */
+int32_t libmpq__file_number(mpq_archive_s *mpq_archive, const char *filename, uint32_t *number) {
+
+	/* some common variables. */
+	uint32_t i, hash1, hash2, hash3, ht_count;
+	int32_t result;
+
+	/* load hash table on first use. */
+	if ((result = libmpq__archive_load_hash(mpq_archive)) < 0) {
+
+		/* something on reading hash table failed. */
+		return result;
+	}
+
+	/* if the list of file names doesn't include this one, we'll have
+	 * to figure out the file number the "hard" way.
+	 */
+	ht_count = mpq_archive->mpq_header.hash_table_count;
+
+	hash1 = libmpq__hash_string (filename, 0x0) & (ht_count - 1);
+	hash2 = libmpq__hash_string (filename, 0x100);
+	hash3 = libmpq__hash_string (filename, 0x200);
+
+	/* loop through all files in mpq archive.
+	 * hash1 gives us a clue about the starting position of this
+	 * search.
+	 */
+	for (i = hash1; mpq_archive->mpq_hash[i].block_table_index != LIBMPQ_HASH_FREE; i = (i + 1) & (ht_count - 1)) {
+
+		/* if the other two hashes match, we found our file number. */
+		if (mpq_archive->mpq_hash[i].hash_a == hash2 &&
+		    mpq_archive->mpq_hash[i].hash_b == hash3) {
+
+			/* load block table on first use, the file number depends on the map. */
+			if ((result = libmpq__archive_load_block(mpq_archive)) < 0) {
+
+				/* something on reading block table failed. */
+				return result;
+			}
+
+			/* return the file number. */
+			*number = mpq_archive->mpq_hash[i].block_table_index - mpq_archive->mpq_map[mpq_archive->mpq_hash[i].block_table_index].block_table_diff;
+
+			/* we found our file, return zero. */
+			return LIBMPQ_SUCCESS;
+		}
+
+		/* check if we have cycled through the whole hash table */
+		if (((i + 1) & (ht_count - 1)) == hash1) {
+			break;
+		}
+	}
+
+	/* if no matching entry found, so return error. */
+	return LIBMPQ_ERROR_EXIST;
+}
+
+/* this function decrypt the block in place if the file is encrypted. */
+static int32_t libmpq__block_decrypt(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t block_number, uint8_t *buf, libmpq__off_t size) {
+
+	/* some common variables. */
+	uint32_t seed       = 0;
+	uint32_t encrypted  = 0;
+
+	/* get encryption status. */
+	libmpq__file_encrypted(mpq_archive, file_number, &encrypted);
+
+	/* check if file is encrypted. */
+	if (encrypted) {
+
+		/* get decryption key, the packed block offset table is opened by the caller. */
+		seed = mpq_archive->mpq_file[file_number]->seed + block_number;
+
+		/* decrypt block. */
+		if (libmpq__decrypt_block((uint32_t *)buf, size, seed) < 0) {
+
+			/* something on decrypting block failed. */
+			return LIBMPQ_ERROR_DECRYPT;
+		}
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return true if the packed block holds the unpacked data as is, so it can be read straight into the output buffer. */
+static uint32_t libmpq__block_stored(mpq_archive_s *mpq_archive, uint32_t file_number, libmpq__off_t in_size, libmpq__off_t unpacked_size) {
+
+	/* some common variables. */
+	uint32_t compressed = 0;
+	uint32_t imploded   = 0;
+
+	/* get compression and implosion status. */
+	libmpq__file_compressed(mpq_archive, file_number, &compressed);
+	libmpq__file_imploded(mpq_archive, file_number, &imploded);
+
+	/* blocks of stored files and blocks which did not shrink on compression are kept as is. */
+	return in_size == unpacked_size && !(compressed && imploded) ? TRUE : FALSE;
+}
+
+/* this function decrypt the block in place and decompress it into the output buffer. */
+static int32_t libmpq__block_unpack(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t block_number, uint8_t *in_buf, libmpq__off_t in_size, uint8_t *out_buf, libmpq__off_t out_size, int32_t *tb) {
+
+	/* some common variables. */
+	int32_t result      = 0;
+	uint32_t compressed = 0;
+	uint32_t imploded   = 0;
+
+	/* decrypt block. */
+	if ((result = libmpq__block_decrypt(mpq_archive, file_number, block_number, in_buf, in_size)) < 0) {
+
+		/* something on decrypting block failed. */
+		return result;
+	}
+
+	/* get compression status. */
+	libmpq__file_compressed(mpq_archive, file_number, &compressed);
+
+	/* check if file is compressed. */
+	if (compressed) {
+
+		/* decompress block. */
+		if ((*tb = libmpq__decompress_block(in_buf, in_size, out_buf, out_size, LIBMPQ_FLAG_COMPRESS_MULTI)) < 0) {
+
+			/* something on decompressing block failed. */
+			return LIBMPQ_ERROR_UNPACK;
+		}
+	}
+
+	/* get implosion status. */
+	libmpq__file_imploded(mpq_archive, file_number, &imploded);
+
+	/* check if file is imploded. */
+	if (imploded) {
+
+		/* explode block. */
+		if ((*tb = libmpq__decompress_block(in_buf, in_size, out_buf, out_size, LIBMPQ_FLAG_COMPRESS_PKZIP)) < 0) {
+
+			/* something on decompressing block failed. */
+			return LIBMPQ_ERROR_UNPACK;
+		}
+	}
+
+	/* files should not be compressed and imploded */
+	if (compressed && imploded) {
+		/* something on decompressing block failed. */
+		return LIBMPQ_ERROR_UNPACK;
+	}
+
+	/* check if file is neither compressed nor imploded. */
+	if (!compressed && !imploded) {
+
+		/* copy block. */
+		if ((*tb = libmpq__decompress_block(in_buf, in_size, out_buf, out_size, LIBMPQ_FLAG_COMPRESS_NONE)) < 0) {
+
+			/* something on decompressing block failed. */
+			return LIBMPQ_ERROR_UNPACK;
+		}
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* state shared by the completions of a batched file read. */
+typedef struct {
+	mpq_archive_s	*mpq_archive;		/* archive the file belongs to. */
+	uint32_t	file_number;		/* file which is read. */
+	uint8_t		*out_buf;		/* start of the output buffer. */
+	libmpq__io_request_s *requests;		/* read requests, one per block which was not cached. */
+	int32_t		result;			/* first error of any block. */
+	libmpq__off_t	transferred;		/* number of unpacked bytes. */
+	pthread_mutex_t	lock;			/* protects result and transferred. */
+} file_batch_s;
+
+/* this function unpack a block as soon as its read finished. */
+static void libmpq__file_read_complete(libmpq__io_request_s *request, void *data) {
+
+	/* some common variables. */
+	file_batch_s *batch    = data;
+	uint32_t block_number  = (uint32_t)(uintptr_t)request->data;
+	int32_t result         = request->result;
+	int32_t tb             = 0;
+	uint8_t *out_buf       = batch->out_buf + (libmpq__off_t)batch->mpq_archive->block_size * block_number;
+	libmpq__off_t unpacked_size = 0;
+
+	/* check if stored block was read straight into its place in the output buffer. */
+	if (result == LIBMPQ_SUCCESS && request->buffer == out_buf) {
+
+		/* decrypt block in place. */
+		result = libmpq__block_decrypt(batch->mpq_archive, batch->file_number, block_number, out_buf, request->size);
+		tb     = request->size;
+	} else if (result == LIBMPQ_SUCCESS) {
+
+		/* get unpacked block size. */
+		libmpq__block_size_unpacked(batch->mpq_archive, batch->file_number, block_number, &unpacked_size);
+
+		/* decrypt and decompress block into its place in the output buffer. */
+		result = libmpq__block_unpack(batch->mpq_archive, batch->file_number, block_number, request->buffer, request->size, out_buf, unpacked_size, &tb);
+	}
+
+	/* check if block was unpacked. */
+	if (result == LIBMPQ_SUCCESS) {
+
+		/* remember unpacked block for the next reader. */
+		libmpq__cache_put(&batch->mpq_archive->cache, batch->file_number, block_number, out_buf, tb);
+	}
+
+	/* store result, completions may arrive from different threads. */
+	pthread_mutex_lock(&batch->lock);
+	if (result < 0 && batch->result == LIBMPQ_SUCCESS) {
+		batch->result = result;
+	}
+	if (result == LIBMPQ_SUCCESS) {
+		batch->transferred += tb;
+	}
+	pthread_mutex_unlock(&batch->lock);
+}
+
+/* this function only note that a read finished, the block is unpacked later by the worker threads. */
+static void libmpq__file_read_arrived(libmpq__io_request_s *request, void *data) {
+
+	/* nothing to do, the request keeps its result. */
+	(void)request;
+	(void)data;
+}
+
+/* this function unpack the block of a finished read, called by the worker threads. */
+static void libmpq__file_read_job(void *data, uint32_t index) {
+
+	/* some common variables. */
+	file_batch_s *batch = data;
+
+	/* unpack block as if its read just finished. */
+	libmpq__file_read_complete(&batch->requests[index], batch);
+}
+
+/* this function submit reads for all blocks of a file at once and unpack them as they complete. */
+static int32_t libmpq__file_read_batch(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t blocks, libmpq__off_t file_offset, uint8_t *out_buf, libmpq__off_t *transferred) {
+
+	/* some common variables. */
+	uint32_t i;
+	uint32_t count          = 0;
+	uint32_t *packed_offset = mpq_archive->mpq_file[file_number]->packed_offset;
+	uint8_t *in_buf;
+	int32_t result;
+	int32_t tb;
+	libmpq__off_t in_size   = 0;
+	libmpq__off_t unpacked_size;
+	libmpq__io_request_s *requests;
+	file_batch_s batch;
+
+	/* take requests from the scratch buffers of this thread. */
+	if ((requests = libmpq__scratch_alloc(LIBMPQ_SCRATCH_REQUESTS, blocks * sizeof(libmpq__io_request_s))) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* cleanup requests. */
+	memset(requests, 0, blocks * sizeof(libmpq__io_request_s));
+
+	/* initialize shared state. */
+	batch.mpq_archive = mpq_archive;
+	batch.file_number = file_number;
+	batch.out_buf     = out_buf;
+	batch.requests    = requests;
+	batch.result      = LIBMPQ_SUCCESS;
+	batch.transferred = 0;
+
+	/* build one request per block which is not cached. */
+	for (i = 0; i < blocks; i++) {
+
+		/* check if packed block offset table is sane. */
+		if (packed_offset[i + 1] < packed_offset[i]) {
+
+			/* release requests. */
+			libmpq__scratch_free(LIBMPQ_SCRATCH_REQUESTS, requests);
+
+			/* offset table is corrupt. */
+			return LIBMPQ_ERROR_READ;
+		}
+
+		/* get unpacked block size. */
+		libmpq__block_size_unpacked(mpq_archive, file_number, i, &unpacked_size);
+
+		/* check if block is cached, then it is copied into its place right now. */
+		if (libmpq__cache_get(&mpq_archive->cache, file_number, i, out_buf + (libmpq__off_t)mpq_archive->block_size * i, unpacked_size, &tb) == LIBMPQ_SUCCESS) {
+			batch.transferred += tb;
+			continue;
+		}
+
+		/* compute block position. */
+		requests[count].offset = file_offset + packed_offset[i] + mpq_archive->archive_offset;
+		requests[count].size   = packed_offset[i + 1] - packed_offset[i];
+		requests[count].data   = (void *)(uintptr_t)i;
+
+		/* check if block is stored, then it is read straight into its place in the output buffer. */
+		if (libmpq__block_stored(mpq_archive, file_number, requests[count].size, unpacked_size)) {
+			requests[count].buffer = out_buf + (libmpq__off_t)mpq_archive->block_size * i;
+		} else {
+			in_size += (requests[count].size + 7) & ~7;
+		}
+		count++;
+	}
+
+	/* check if all blocks were cached. */
+	if (count == 0) {
+
+		/* release requests. */
+		libmpq__scratch_free(LIBMPQ_SCRATCH_REQUESTS, requests);
+
+		/* store transferred bytes. */
+		*transferred = batch.transferred;
+
+		/* if no error was found, return zero. */
+		return LIBMPQ_SUCCESS;
+	}
+
+	/* take buffer for the packed blocks from the scratch buffers of this thread, stored blocks need none. */
+	if (in_size == 0) {
+		in_buf = NULL;
+	} else if ((in_buf = libmpq__scratch_alloc(LIBMPQ_SCRATCH_PACKED, in_size)) == NULL) {
+
+		/* release requests. */
+		libmpq__scratch_free(LIBMPQ_SCRATCH_REQUESTS, requests);
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* assign buffers to the remaining requests, each block starts word aligned for decryption. */
+	for (i = 0, in_size = 0; i < count; i++) {
+		if (requests[i].buffer == NULL) {
+			requests[i].buffer = in_buf + in_size;
+			in_size += (requests[i].size + 7) & ~7;
+		}
+	}
+
+	/* initialize lock for the completions. */
+	pthread_mutex_init(&batch.lock, NULL);
+
+	/* check if worker threads are available, then blocks are unpacked by them after all reads finished. */
+	if (libmpq__pool_size(&mpq_archive->pool) > 0 && count > 1) {
+
+		/* read all blocks and unpack them at the same time. */
+		if ((result = libmpq__io_read_batch(mpq_archive->io, mpq_archive->io_handle, requests, count, libmpq__file_read_arrived, &batch)) >= 0) {
+			libmpq__pool_run(&mpq_archive->pool, libmpq__file_read_job, &batch, count);
+		}
+	} else {
+
+		/* read all blocks, they are unpacked on completion. */
+		result = libmpq__io_read_batch(mpq_archive->io, mpq_archive->io_handle, requests, count, libmpq__file_read_complete, &batch);
+	}
+
+	/* release buffers and state. */
+	pthread_mutex_destroy(&batch.lock);
+	libmpq__scratch_free(LIBMPQ_SCRATCH_REQUESTS, requests);
+	libmpq__scratch_free(LIBMPQ_SCRATCH_PACKED, in_buf);
+
+	/* check if reading or unpacking failed. */
+	if (result < 0 || (result = batch.result) < 0) {
+
+		/* something on reading block failed. */
+		return result;
+	}
+
+	/* store transferred bytes. */
+	*transferred = batch.transferred;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* state shared by the workers unpacking the blocks of a packed range. */
+typedef struct {
+	mpq_archive_s	*mpq_archive;		/* archive the file belongs to. */
+	uint32_t	file_number;		/* file which is read. */
+	uint32_t	from;			/* block at the start of the output buffer. */
+	uint32_t	first;			/* first block of the range. */
+	uint8_t		*in_buf;		/* packed range. */
+	uint8_t		*out_buf;		/* output buffer, starts with block from. */
+	uint8_t		*missed;		/* blocks which were not cached. */
+	int32_t		result;			/* first error of any block. */
+	libmpq__off_t	transferred;		/* number of unpacked bytes. */
+	pthread_mutex_t	lock;			/* protects result and transferred. */
+} file_extent_s;
+
+/* this function unpack one block of the packed range into its place in the output buffer. */
+static void libmpq__file_extent_job(void *data, uint32_t index) {
+
+	/* some common variables. */
+	file_extent_s *extent   = data;
+	uint32_t block_number   = extent->first + index;
+	uint32_t *packed_offset = extent->mpq_archive->mpq_file[extent->file_number]->packed_offset;
+	uint8_t *in_buf         = extent->in_buf + packed_offset[block_number] - packed_offset[extent->first];
+	uint8_t *out_buf        = extent->out_buf + (libmpq__off_t)extent->mpq_archive->block_size * (block_number - extent->from);
+	int32_t result          = LIBMPQ_SUCCESS;
+	int32_t tb              = 0;
+	libmpq__off_t in_size   = packed_offset[block_number + 1] - packed_offset[block_number];
+	libmpq__off_t unpacked_size = 0;
+
+	/* check if block is cached. */
+	if (!extent->missed[block_number]) {
+		return;
+	}
+
+	/* get unpacked block size. */
+	libmpq__block_size_unpacked(extent->mpq_archive, extent->file_number, block_number, &unpacked_size);
+
+	/* decrypt and decompress block into its place in the output buffer. */
+	if ((result = libmpq__block_unpack(extent->mpq_archive, extent->file_number, block_number, in_buf, in_size, out_buf, unpacked_size, &tb)) == LIBMPQ_SUCCESS) {
+
+		/* remember unpacked block for the next reader. */
+		libmpq__cache_put(&extent->mpq_archive->cache, extent->file_number, block_number, out_buf, tb);
+	}
+
+	/* store result, workers finish in any order. */
+	pthread_mutex_lock(&extent->lock);
+	if (result < 0 && extent->result == LIBMPQ_SUCCESS) {
+		extent->result = result;
+	}
+	if (result == LIBMPQ_SUCCESS) {
+		extent->transferred += tb;
+	}
+	pthread_mutex_unlock(&extent->lock);
+}
+
+/* this function read the packed blocks from one to the other of a file which are not cached with one read and unpack them out of it, the output buffer starts with the first block and in_data is the packed file if it is in memory already. */
+static int32_t libmpq__file_read_extent(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t from, uint32_t to, libmpq__off_t file_offset, uint8_t *in_data, uint8_t *out_buf, libmpq__off_t *transferred) {
+
+	/* some common variables. */
+	uint32_t i;
+	uint32_t first          = to;
+	uint32_t last           = 0;
+	uint32_t stored         = TRUE;
+	uint32_t encrypted      = 0;
+	uint32_t *packed_offset = mpq_archive->mpq_file[file_number]->packed_offset;
+	uint8_t *missed;
+	uint8_t *in_buf;
+	uint8_t *in_copy        = NULL;
+	int32_t result          = LIBMPQ_SUCCESS;
+	int32_t tb;
+	libmpq__off_t in_size;
+	libmpq__off_t in_offset;
+	libmpq__off_t unpacked_size;
+	libmpq__off_t total     = 0;
+	file_extent_s extent;
+
+	/* take list of blocks which are not cached from the scratch buffers of this thread. */
+	if ((missed = libmpq__scratch_alloc(LIBMPQ_SCRATCH_REQUESTS, to)) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* copy cached blocks into their place and find the range of blocks which have to be read. */
+	for (i = from; i < to; i++) {
+
+		/* check if packed block offset table is sane. */
+		if (packed_offset[i + 1] < packed_offset[i]) {
+
+			/* release list. */
+			libmpq__scratch_free(LIBMPQ_SCRATCH_REQUESTS, missed);
+
+			/* offset table is corrupt. */
+			return LIBMPQ_ERROR_READ;
+		}
+
+		/* get unpacked block size. */
+		libmpq__block_size_unpacked(mpq_archive, file_number, i, &unpacked_size);
+
+		/* check if block is cached, then it is copied into its place right now. */
+		if (libmpq__cache_get(&mpq_archive->cache, file_number, i, out_buf + (libmpq__off_t)mpq_archive->block_size * (i - from), unpacked_size, &tb) == LIBMPQ_SUCCESS) {
+			missed[i] = FALSE;
+			total    += tb;
+			continue;
+		}
+
+		/* block has to be read. */
+		missed[i] = TRUE;
+		first     = first < i ? first : i;
+		last      = i;
+	}
+
+	/* check if all blocks were cached. */
+	if (first == to) {
+		goto done;
+	}
+
+	/* compute position of the packed range. */
+	in_size   = packed_offset[last + 1] - packed_offset[first];
+	in_offset = file_offset + packed_offset[first] + mpq_archive->archive_offset;
+
+	/* check if all blocks in the range are stored, then they are read straight into the output buffer. */
+	for (i = first; stored && i <= last; i++) {
+		libmpq__block_size_unpacked(mpq_archive, file_number, i, &unpacked_size);
+		stored = libmpq__block_stored(mpq_archive, file_number, packed_offset[i + 1] - packed_offset[i], unpacked_size);
+	}
+
+	/* check if range can be read straight into the output buffer. */
+	if (stored) {
+
+		/* read or copy range, cached blocks in between are overwritten by the same data. */
+		if (in_data != NULL) {
+			memcpy(out_buf + (libmpq__off_t)mpq_archive->block_size * (first - from), in_data + packed_offset[first], in_size);
+		} else if ((result = libmpq__archive_read(mpq_archive, out_buf + (libmpq__off_t)mpq_archive->block_size * (first - from), in_size, in_offset)) < 0) {
+			goto done;
+		}
+
+		/* decrypt all blocks of the range in place. */
+		for (i = first; i <= last; i++) {
+
+			/* decrypt block. */
+			if ((result = libmpq__block_decrypt(mpq_archive, file_number, i, out_buf + (libmpq__off_t)mpq_archive->block_size * (i - from), packed_offset[i + 1] - packed_offset[i])) < 0) {
+				goto done;
+			}
+
+			/* check if block was read for the first time. */
+			if (missed[i]) {
+
+				/* remember unpacked block for the next reader. */
+				libmpq__cache_put(&mpq_archive->cache, file_number, i, out_buf + (libmpq__off_t)mpq_archive->block_size * (i - from), packed_offset[i + 1] - packed_offset[i]);
+				total += packed_offset[i + 1] - packed_offset[i];
+			}
+		}
+
+		/* all blocks read. */
+		goto done;
+	}
+
+	/* get encryption status. */
+	libmpq__file_encrypted(mpq_archive, file_number, &encrypted);
+
+	/* check if packed file is in memory already, it belongs to the caller so blocks may be decrypted in place. */
+	if (in_data != NULL) {
+		in_buf = in_data + packed_offset[first];
+	} else if (encrypted || (in_buf = libmpq__archive_map(mpq_archive, in_size, in_offset)) == NULL) {
+
+		/* take read buffer from the scratch buffers of this thread. */
+		if ((in_buf = in_copy = libmpq__scratch_alloc(LIBMPQ_SCRATCH_PACKED, in_size)) == NULL) {
+
+			/* memory allocation problem. */
+			result = LIBMPQ_ERROR_MALLOC;
+			goto done;
+		}
+
+		/* read range from file. */
+		if ((result = libmpq__archive_read(mpq_archive, in_buf, in_size, in_offset)) < 0) {
+			goto done;
+		}
+	}
+
+	/* initialize shared state. */
+	extent.mpq_archive = mpq_archive;
+	extent.file_number = file_number;
+	extent.from        = from;
+	extent.first       = first;
+	extent.in_buf      = in_buf;
+	extent.out_buf     = out_buf;
+	extent.missed      = missed;
+	extent.result      = LIBMPQ_SUCCESS;
+	extent.transferred = 0;
+	pthread_mutex_init(&extent.lock, NULL);
+
+	/* unpack all blocks which were not cached, the worker threads share them if available. */
+	libmpq__pool_run(&mpq_archive->pool, libmpq__file_extent_job, &extent, last - first + 1);
+
+	/* collect result. */
+	pthread_mutex_destroy(&extent.lock);
+	result = extent.result;
+	total += extent.transferred;
+
+done:
+	/* release buffers. */
+	libmpq__scratch_free(LIBMPQ_SCRATCH_PACKED, in_copy);
+	libmpq__scratch_free(LIBMPQ_SCRATCH_REQUESTS, missed);
+
+	/* store transferred bytes. */
+	*transferred = total;
+
+	/* return result of the last operation. */
+	return result;
+}
+
+/* this function drop the packed data of a file which was read whole from the page cache, if the archive asks for it. */
+static void libmpq__file_drop(mpq_archive_s *mpq_archive, uint32_t file_number) {
+
+	/* some common variables. */
+	libmpq__off_t file_offset = 0;
+	libmpq__off_t packed_size = 0;
+
+	/* check if dropping is wanted and the storage backend takes hints, readers check it without lock. */
+	if ((__atomic_load_n(&mpq_archive->advice, __ATOMIC_RELAXED) & LIBMPQ_ADVISE_DROP) == 0 || mpq_archive->io->advise == NULL) {
+		return;
+	}
+
+	/* get range of packed file. */
+	libmpq__file_offset(mpq_archive, file_number, &file_offset);
+	libmpq__file_size_packed(mpq_archive, file_number, &packed_size);
+
+	/* dropping is only a hint, so errors are ignored, an empty range would mean up to the end of storage. */
+	if (packed_size > 0) {
+		mpq_archive->io->advise(mpq_archive->io_handle, packed_size, file_offset + mpq_archive->archive_offset, LIBMPQ_ADVISE_DONTNEED);
+	}
+}
+
+/* this function read the given file from archive into a buffer. */
+int32_t libmpq__file_read(mpq_archive_s *mpq_archive, uint32_t file_number, uint8_t *out_buf, libmpq__off_t out_size, libmpq__off_t *transferred) {
+
+	/* some common variables. */
+	uint32_t blocks         = 0;
+	int32_t result          = 0;
+	libmpq__off_t file_offset       = 0;
+	libmpq__off_t packed_size       = 0;
+	libmpq__off_t unpacked_size     = 0;
+	libmpq__off_t transferred_total = 0;
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* get target size of block. */
+	libmpq__file_size_unpacked(mpq_archive, file_number, &unpacked_size);
+
+	/* check if target buffer is to small. */
+	if (unpacked_size > out_size) {
+
+		/* output buffer size is to small or block size is unknown. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* fetch file offset. */
+	libmpq__file_offset(mpq_archive, file_number, &file_offset);
+
+	/* get block count for file. */
+	libmpq__file_blocks(mpq_archive, file_number, &blocks);
+
+	/* open the packed block offset table. */
+	if ((result = libmpq__block_open_offset(mpq_archive, file_number)) < 0) {
+
+		/* something on opening packed block offset table failed. */
+		return result;
+	}
+
+	/* tell the storage backend which range we are going to read. */
+	if (mpq_archive->io->prefetch != NULL) {
+
+		/* get packed size of file. */
+		libmpq__file_size_packed(mpq_archive, file_number, &packed_size);
+
+		/* prefetch is only a hint, so errors are ignored. */
+		mpq_archive->io->prefetch(mpq_archive->io_handle, packed_size, file_offset + mpq_archive->archive_offset);
+	}
+
+	/* check if the storage backend can keep many reads in flight. */
+	if (mpq_archive->io->read_batch != NULL && blocks > 0) {
+
+		/* read all blocks at once, each one is unpacked as soon as it arrived. */
+		result = libmpq__file_read_batch(mpq_archive, file_number, blocks, file_offset, out_buf, &transferred_total);
+	} else if (blocks > 0) {
+
+		/* read the packed blocks with one read and unpack them out of it. */
+		result = libmpq__file_read_extent(mpq_archive, file_number, 0, blocks, file_offset, NULL, out_buf, &transferred_total);
+	}
+
+	/* close the packed block offset table. */
+	libmpq__block_close_offset(mpq_archive, file_number);
+
+	/* drop packed data behind the read. */
+	libmpq__file_drop(mpq_archive, file_number);
+
+	/* check if reading failed. */
+	if (result < 0) {
+
+		/* something on reading block failed. */
+		return result;
+	}
+
+	/* check for null pointer. */
+	if (transferred != NULL) {
+
+		/* store transferred bytes. */
+		*transferred = transferred_total;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function read a piece of one block, which must not be the whole block, into the output buffer. */
+static int32_t libmpq__file_read_piece(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t block_number, libmpq__off_t file_offset, libmpq__off_t skip, uint8_t *out_buf, libmpq__off_t length) {
+
+	/* some common variables. */
+	uint32_t *packed_offset = mpq_archive->mpq_file[file_number]->packed_offset;
+	uint32_t encrypted      = 0;
+	uint8_t *block;
+	int32_t result          = 0;
+	libmpq__off_t unpacked_size = 0;
+	libmpq__off_t tb            = 0;
+
+	/* get unpacked block size and encryption status. */
+	libmpq__block_size_unpacked(mpq_archive, file_number, block_number, &unpacked_size);
+	libmpq__file_encrypted(mpq_archive, file_number, &encrypted);
+
+	/* check if block is stored without encryption, then only the wanted bytes are read. */
+	if (!encrypted && libmpq__block_stored(mpq_archive, file_number, packed_offset[block_number + 1] - packed_offset[block_number], unpacked_size)) {
+
+		/* read piece straight into the output buffer. */
+		return libmpq__archive_read(mpq_archive, out_buf, length, file_offset + packed_offset[block_number] + skip + mpq_archive->archive_offset);
+	}
+
+	/* take buffer for the whole block from the scratch buffers of this thread. */
+	if ((block = libmpq__scratch_alloc(LIBMPQ_SCRATCH_UNPACKED, unpacked_size)) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* unpack whole block and copy the wanted piece, a short block would hand out stale bytes of the buffer. */
+	if ((result = libmpq__block_read(mpq_archive, file_number, block_number, block, unpacked_size, &tb)) == LIBMPQ_SUCCESS) {
+		if (tb != unpacked_size) {
+			result = LIBMPQ_ERROR_UNPACK;
+		} else {
+			memcpy(out_buf, block + skip, length);
+		}
+	}
+
+	/* release buffer. */
+	libmpq__scratch_free(LIBMPQ_SCRATCH_UNPACKED, block);
+
+	/* return result of the read. */
+	return result;
+}
+
+/* this function read a range of the given file into a buffer and only unpack the blocks which cover it. */
+int32_t libmpq__file_read_range(mpq_archive_s *mpq_archive, uint32_t file_number, libmpq__off_t offset, uint8_t *out_buf, libmpq__off_t out_size, libmpq__off_t *transferred) {
+
+	/* some common variables. */
+	uint32_t blocks         = 0;
+	uint32_t first;
+	uint32_t last;
+	uint32_t whole_first;
+	uint32_t whole_last;
+	int32_t result          = 0;
+	libmpq__off_t file_offset   = 0;
+	libmpq__off_t unpacked_size = 0;
+	libmpq__off_t block_size;
+	libmpq__off_t length;
+	libmpq__off_t end;
+	libmpq__off_t tb;
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* check if range is valid. */
+	if (offset < 0 || out_size < 0) {
+
+		/* range starts before the file or has negative size. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* get unpacked size of file and block count. */
+	libmpq__file_size_unpacked(mpq_archive, file_number, &unpacked_size);
+	libmpq__file_offset(mpq_archive, file_number, &file_offset);
+	libmpq__file_blocks(mpq_archive, file_number, &blocks);
+
+	/* clip range at the end of file. */
+	length = offset < unpacked_size ? (out_size < unpacked_size - offset ? out_size : unpacked_size - offset) : 0;
+	end    = offset + length;
+
+	/* check if there is anything to read. */
+	if (length > 0) {
+
+		/* open the packed block offset table. */
+		if ((result = libmpq__block_open_offset(mpq_archive, file_number)) < 0) {
+
+			/* something on opening packed block offset table failed. */
+			return result;
+		}
+
+		/* compute covering blocks, a file with one block may be larger than the archive block size if it is stored in a single sector. */
+		block_size  = blocks == 1 ? unpacked_size : mpq_archive->block_size;
+		first       = offset / block_size;
+		last        = (end - 1) / block_size;
+
+		/* blocks which are wanted as a whole are unpacked straight into the output buffer, the last block of the file is whole if the range reaches the end. */
+		whole_first = offset % block_size == 0 ? first : first + 1;
+		whole_last  = end % block_size == 0 || end == unpacked_size ? last + 1 : last;
+
+		/* check if range starts inside a block. */
+		if (whole_first > first) {
+
+			/* read head of the range, it may also be the tail if the range is inside one block. */
+			result = libmpq__file_read_piece(mpq_archive, file_number, first, file_offset, offset % block_size, out_buf, first == last ? length : block_size - offset % block_size);
+		}
+
+		/* check if any block is wanted as a whole. */
+		if (result == LIBMPQ_SUCCESS && whole_last > whole_first) {
+
+			/* read and unpack whole blocks with one read. */
+			result = libmpq__file_read_extent(mpq_archive, file_number, whole_first, whole_last, file_offset, NULL, out_buf + (block_size * whole_first - offset), &tb);
+
+			/* check if blocks unpacked to the expected size, otherwise the output would have holes. */
+			if (result == LIBMPQ_SUCCESS && tb != (end < block_size * whole_last ? end : block_size * whole_last) - block_size * whole_first) {
+				result = LIBMPQ_ERROR_UNPACK;
+			}
+		}
+
+		/* check if range ends inside a block which was not read yet. */
+		if (result == LIBMPQ_SUCCESS && whole_last <= last && (last > first || whole_first == first)) {
+
+			/* read tail of the range. */
+			result = libmpq__file_read_piece(mpq_archive, file_number, last, file_offset, 0, out_buf + (block_size * last - offset), end - block_size * last);
+		}
+
+		/* close the packed block offset table. */
+		libmpq__block_close_offset(mpq_archive, file_number);
+
+		/* check if reading failed. */
+		if (result < 0) {
+
+			/* something on reading block failed. */
+			return result;
+		}
+	}
+
+	/* check for null pointer. */
+	if (transferred != NULL) {
+
+		/* store transferred bytes. */
+		*transferred = length;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function read one block which spans several output segments and scatter it over them. */
+static int32_t libmpq__file_read_scatter(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t block_number, libmpq__off_t file_offset, const libmpq__iovec_s *iov, uint32_t count, uint32_t *segment, libmpq__off_t *position) {
+
+	/* some common variables. */
+	uint32_t *packed_offset = mpq_archive->mpq_file[file_number]->packed_offset;
+	uint32_t encrypted      = 0;
+	uint8_t *block          = NULL;
+	int32_t result          = 0;
+	libmpq__off_t unpacked_size = 0;
+	libmpq__off_t done          = 0;
+	libmpq__off_t length;
+	libmpq__off_t tb            = 0;
+
+	/* get unpacked block size and encryption status. */
+	libmpq__block_size_unpacked(mpq_archive, file_number, block_number, &unpacked_size);
+	libmpq__file_encrypted(mpq_archive, file_number, &encrypted);
+
+	/* check if block must be unpacked first, stored blocks without encryption are read piece by piece straight into the segments. */
+	if (encrypted || !libmpq__block_stored(mpq_archive, file_number, packed_offset[block_number + 1] - packed_offset[block_number], unpacked_size)) {
+
+		/* take buffer for the whole block from the scratch buffers of this thread. */
+		if ((block = libmpq__scratch_alloc(LIBMPQ_SCRATCH_UNPACKED, unpacked_size)) == NULL) {
+
+			/* memory allocation problem. */
+			return LIBMPQ_ERROR_MALLOC;
+		}
+
+		/* unpack whole block once, no matter how many segments it spans. */
+		if ((result = libmpq__block_read(mpq_archive, file_number, block_number, block, unpacked_size, &tb)) == LIBMPQ_SUCCESS && tb != unpacked_size) {
+
+			/* block unpacked to less bytes than stored in the block table. */
+			result = LIBMPQ_ERROR_UNPACK;
+		}
+	}
+
+	/* hand out the block segment by segment. */
+	while (result == LIBMPQ_SUCCESS && done < unpacked_size) {
+
+		/* skip segments which are full. */
+		if (*position == iov[*segment].size) {
+
+			/* check if there is another segment, the caller checked the total size. */
+			if (++(*segment) >= count) {
+				result = LIBMPQ_ERROR_SIZE;
+				break;
+			}
+			*position = 0;
+			continue;
+		}
+
+		/* fill as much of the segment as the block has left. */
+		length = unpacked_size - done < iov[*segment].size - *position ? unpacked_size - done : iov[*segment].size - *position;
+
+		/* check if block was unpacked. */
+		if (block != NULL) {
+			memcpy((uint8_t *)iov[*segment].buffer + *position, block + done, length);
+		} else {
+			result = libmpq__archive_read(mpq_archive, (uint8_t *)iov[*segment].buffer + *position, length, file_offset + packed_offset[block_number] + done + mpq_archive->archive_offset);
+		}
+
+		/* advance in block and segment. */
+		done      += length;
+		*position += length;
+	}
+
+	/* release buffer. */
+	libmpq__scratch_free(LIBMPQ_SCRATCH_UNPACKED, block);
+
+	/* return result of the last operation. */
+	return result;
+}
+
+/* this function read the given file from archive into a list of output segments, blocks are unpacked straight into them. */
+int32_t libmpq__file_read_vector(mpq_archive_s *mpq_archive, uint32_t file_number, const libmpq__iovec_s *iov, uint32_t count, libmpq__off_t *transferred) {
+
+	/* some common variables. */
+	uint32_t i;
+	uint32_t blocks         = 0;
+	uint32_t block          = 0;
+	uint32_t segment        = 0;
+	uint32_t whole;
+	int32_t result          = 0;
+	libmpq__off_t file_offset   = 0;
+	libmpq__off_t packed_size   = 0;
+	libmpq__off_t unpacked_size = 0;
+	libmpq__off_t total         = 0;
+	libmpq__off_t position      = 0;
+	libmpq__off_t block_size;
+	libmpq__off_t end;
+	libmpq__off_t tb;
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* add up size of all segments. */
+	for (i = 0; i < count; i++) {
+
+		/* check if segment size is valid. */
+		if (iov[i].size < 0) {
+
+			/* segment has negative size. */
+			return LIBMPQ_ERROR_SIZE;
+		}
+		total += iov[i].size;
+	}
+
+	/* get target size of file. */
+	libmpq__file_size_unpacked(mpq_archive, file_number, &unpacked_size);
+
+	/* check if segments are to small. */
+	if (unpacked_size > total) {
+
+		/* output segments are to small for the file. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* fetch file offset and block count. */
+	libmpq__file_offset(mpq_archive, file_number, &file_offset);
+	libmpq__file_blocks(mpq_archive, file_number, &blocks);
+
+	/* check if there is anything to read. */
+	if (unpacked_size > 0) {
+
+		/* open the packed block offset table. */
+		if ((result = libmpq__block_open_offset(mpq_archive, file_number)) < 0) {
+
+			/* something on opening packed block offset table failed. */
+			return result;
+		}
+
+		/* tell the storage backend which range we are going to read. */
+		if (mpq_archive->io->prefetch != NULL) {
+
+			/* prefetch is only a hint, so errors are ignored. */
+			libmpq__file_size_packed(mpq_archive, file_number, &packed_size);
+			mpq_archive->io->prefetch(mpq_archive->io_handle, packed_size, file_offset + mpq_archive->archive_offset);
+		}
+
+		/* a file with one block may be larger than the archive block size if it is stored in a single sector. */
+		block_size = blocks == 1 ? unpacked_size : mpq_archive->block_size;
+
+		/* loop until all blocks are in the segments. */
+		while (result == LIBMPQ_SUCCESS && block < blocks) {
+
+			/* skip segments which are full. */
+			if (position == iov[segment].size) {
+
+				/* check if there is another segment, the total size was checked above. */
+				if (++segment >= count) {
+					result = LIBMPQ_ERROR_SIZE;
+					break;
+				}
+				position = 0;
+				continue;
+			}
+
+			/* compute blocks which fit into the rest of the segment as a whole. */
+			end   = block_size * block + iov[segment].size - position;
+			whole = end >= unpacked_size ? blocks : end / block_size;
+
+			/* check if any block fits as a whole. */
+			if (whole > block) {
+
+				/* read and unpack them straight into the segment with one read. */
+				result    = libmpq__file_read_extent(mpq_archive, file_number, block, whole, file_offset, NULL, (uint8_t *)iov[segment].buffer + position, &tb);
+
+				/* check if blocks unpacked to the expected size, otherwise the segments would be misaligned. */
+				if (result == LIBMPQ_SUCCESS && tb != (end >= unpacked_size ? unpacked_size : block_size * whole) - block_size * block) {
+					result = LIBMPQ_ERROR_UNPACK;
+				}
+				position += tb;
+				block     = whole;
+			} else {
+
+				/* block spans the end of the segment. */
+				result = libmpq__file_read_scatter(mpq_archive, file_number, block, file_offset, iov, count, &segment, &position);
+				block++;
+			}
+		}
+
+		/* close the packed block offset table. */
+		libmpq__block_close_offset(mpq_archive, file_number);
+
+		/* check if reading failed. */
+		if (result < 0) {
+
+			/* something on reading block failed. */
+			return result;
+		}
+	}
+
+	/* check for null pointer. */
+	if (transferred != NULL) {
+
+		/* store transferred bytes. */
+		*transferred = unpacked_size;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function check if the packed bytes of a block are the unpacked ones, so they can be copied as they are. */
+static uint32_t libmpq__block_copyable(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t block_number) {
+
+	/* some common variables. */
+	uint32_t *packed_offset = mpq_archive->mpq_file[file_number]->packed_offset;
+	libmpq__off_t unpacked_size = 0;
+
+	/* get unpacked block size. */
+	libmpq__block_size_unpacked(mpq_archive, file_number, block_number, &unpacked_size);
+
+	/* check if block is stored, the caller checks encryption. */
+	return libmpq__block_stored(mpq_archive, file_number, packed_offset[block_number + 1] - packed_offset[block_number], unpacked_size);
+}
+
+/* this function write the given file from archive to a file descriptor, stored blocks are copied without passing through user space where possible. */
+int32_t libmpq__file_extract_fd(mpq_archive_s *mpq_archive, uint32_t file_number, int fd, libmpq__off_t *transferred) {
+
+	/* some common variables. */
+	uint32_t *packed_offset;
+	uint32_t blocks         = 0;
+	uint32_t encrypted      = 0;
+	uint32_t block          = 0;
+	uint32_t to;
+	uint8_t *buffer         = NULL;
+	int32_t result          = 0;
+	libmpq__off_t file_offset   = 0;
+	libmpq__off_t packed_size   = 0;
+	libmpq__off_t unpacked_size = 0;
+	libmpq__off_t total         = 0;
+	libmpq__off_t block_size;
+	libmpq__off_t tb;
+
+	/* check if given file number is not out of range. */
+	CHECK_FILE_NUM(file_number, mpq_archive)
+
+	/* get unpacked size, offset, block count and encryption status of file. */
+	libmpq__file_size_unpacked(mpq_archive, file_number, &unpacked_size);
+	libmpq__file_offset(mpq_archive, file_number, &file_offset);
+	libmpq__file_blocks(mpq_archive, file_number, &blocks);
+	libmpq__file_encrypted(mpq_archive, file_number, &encrypted);
+
+	/* check if there is anything to write. */
+	if (unpacked_size > 0) {
+
+		/* open the packed block offset table. */
+		if ((result = libmpq__block_open_offset(mpq_archive, file_number)) < 0) {
+
+			/* something on opening packed block offset table failed. */
+			return result;
+		}
+
+		/* tell the storage backend which range we are going to read. */
+		if (mpq_archive->io->prefetch != NULL) {
+
+			/* prefetch is only a hint, so errors are ignored. */
+			libmpq__file_size_packed(mpq_archive, file_number, &packed_size);
+			mpq_archive->io->prefetch(mpq_archive->io_handle, packed_size, file_offset + mpq_archive->archive_offset);
+		}
+
+		/* a file with one block may be larger than the archive block size if it is stored in a single sector. */
+		packed_offset = mpq_archive->mpq_file[file_number]->packed_offset;
+		block_size    = blocks == 1 ? unpacked_size : mpq_archive->block_size;
+
+		/* loop until all blocks are written. */
+		while (result == LIBMPQ_SUCCESS && block < blocks) {
+
+			/* find run of stored blocks, they lie back to back in the archive and are the file data. */
+			for (to = block; !encrypted && to < blocks && libmpq__block_copyable(mpq_archive, file_number, to); to++);
+
+			/* check if run is not empty. */
+			if (to > block) {
+
+				/* copy whole run at once. */
+				tb     = packed_offset[to] - packed_offset[block];
+				result = libmpq__io_copy(mpq_archive->io, mpq_archive->io_handle, fd, tb, file_offset + packed_offset[block] + mpq_archive->archive_offset);
+				total += tb;
+				block  = to;
+				continue;
+			}
+
+			/* take some blocks to unpack, stop before the next stored one so it is copied instead. */
+			for (to = block + 1; to < blocks && to - block < LIBMPQ_EXTRACT_BLOCKS && (encrypted || !libmpq__block_copyable(mpq_archive, file_number, to)); to++);
+
+			/* take bounded buffer from the scratch buffers of this thread, memory use does not grow with the file size. */
+			if (buffer == NULL &&
+			    (buffer = libmpq__scratch_alloc(LIBMPQ_SCRATCH_UNPACKED, unpacked_size < block_size * LIBMPQ_EXTRACT_BLOCKS ? unpacked_size : block_size * LIBMPQ_EXTRACT_BLOCKS)) == NULL) {
+
+				/* memory allocation problem. */
+				result = LIBMPQ_ERROR_MALLOC;
+				break;
+			}
+
+			/* unpack blocks and write them, a short block would leave a gap in the buffer which is laid out by block position. */
+			if ((result = libmpq__file_read_extent(mpq_archive, file_number, block, to, file_offset, NULL, buffer, &tb)) == LIBMPQ_SUCCESS) {
+				result = tb == (to == blocks ? unpacked_size : block_size * to) - block_size * block ? libmpq__io_write(fd, buffer, tb) : LIBMPQ_ERROR_UNPACK;
+			}
+			total += tb;
+			block  = to;
+		}
+
+		/* release buffer. */
+		libmpq__scratch_free(LIBMPQ_SCRATCH_UNPACKED, buffer);
+
+		/* close the packed block offset table. */
+		libmpq__block_close_offset(mpq_archive, file_number);
+
+		/* drop packed data behind the read. */
+		libmpq__file_drop(mpq_archive, file_number);
+
+		/* check if writing failed. */
+		if (result < 0) {
+
+			/* something on reading or writing block failed. */
+			return result;
+		}
+	}
+
+	/* check for null pointer. */
+	if (transferred != NULL) {
+
+		/* store transferred bytes. */
+		*transferred = total;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* file of a batched read in the order of the archive. */
+typedef struct {
+	uint32_t	slot;			/* entry in the list of the caller. */
+	libmpq__off_t	offset;			/* absolute offset of the packed file. */
+	libmpq__off_t	size;			/* packed size of the file. */
+} read_order_s;
+
+/* this function order files of a batched read by their position in the archive. */
+static int libmpq__read_order(const void *a, const void *b) {
+
+	/* some common variables. */
+	const read_order_s *order_a = a;
+	const read_order_s *order_b = b;
+
+	/* lower offsets first, then in the order of the caller. */
+	if (order_a->offset != order_b->offset) {
+		return order_a->offset < order_b->offset ? -1 : 1;
+	}
+	return order_a->slot < order_b->slot ? -1 : order_a->slot > order_b->slot;
+}
+
+/* this function read one file of a batched read, in_data is the packed file if it was read together with its neighbours. */
+static int32_t libmpq__file_read_packed(mpq_archive_s *mpq_archive, uint32_t file_number, uint8_t *in_data, libmpq__off_t in_size, uint8_t *out_buf, libmpq__off_t out_size, libmpq__off_t *transferred) {
+
+	/* some common variables. */
+	uint32_t blocks         = 0;
+	int32_t result          = 0;
+	libmpq__off_t file_offset   = 0;
+	libmpq__off_t unpacked_size = 0;
+
+	/* get unpacked size of file. */
+	libmpq__file_size_unpacked(mpq_archive, file_number, &unpacked_size);
+
+	/* check if file was not read with its neighbours, then it is read the usual way which also checks the buffer size. */
+	if (in_data == NULL || unpacked_size == 0 || unpacked_size > out_size) {
+		return libmpq__file_read(mpq_archive, file_number, out_buf, out_size, transferred);
+	}
+
+	/* fetch file offset and block count. */
+	libmpq__file_offset(mpq_archive, file_number, &file_offset);
+	libmpq__file_blocks(mpq_archive, file_number, &blocks);
+
+	/* open the packed block offset table. */
+	if ((result = libmpq__block_open_offset(mpq_archive, file_number)) < 0) {
+
+		/* something on opening packed block offset table failed. */
+		return result;
+	}
+
+	/* check if all blocks lie inside the packed file, a corrupt offset table must not reach behind the merged read. */
+	if (blocks == 0 || mpq_archive->mpq_file[file_number]->packed_offset[blocks] > in_size) {
+
+		/* read file the usual way. */
+		libmpq__block_close_offset(mpq_archive, file_number);
+		return libmpq__file_read(mpq_archive, file_number, out_buf, out_size, transferred);
+	}
+
+	/* unpack all blocks out of the merged read. */
+	result = libmpq__file_read_extent(mpq_archive, file_number, 0, blocks, file_offset, in_data, out_buf, transferred);
+
+	/* close the packed block offset table. */
+	libmpq__block_close_offset(mpq_archive, file_number);
+
+	/* drop packed data behind the read. */
+	libmpq__file_drop(mpq_archive, file_number);
+
+	/* return result of the read. */
+	return result;
+}
+
+/* this function read many files in the order of the archive, neighbouring files are read with one read, and hand each one to the callback when it finished. */
+int32_t libmpq__file_read_many(mpq_archive_s *mpq_archive, libmpq__read_s *reads, uint32_t count, libmpq__read_complete_t complete, void *data) {
+
+	/* some common variables. */
+	uint32_t i;
+	uint32_t j;
+	uint32_t k;
+	uint32_t merged;
+	uint8_t *buffer         = NULL;
+	uint8_t *in_data;
+	int32_t result          = LIBMPQ_SUCCESS;
+	libmpq__off_t file_offset;
+	libmpq__off_t start;
+	libmpq__off_t end;
+	libmpq__off_t seen;
+	libmpq__read_s *entry;
+	read_order_s *order;
+
+	/* check if given file numbers are not out of range. */
+	for (i = 0; i < count; i++) {
+		CHECK_FILE_NUM(reads[i].file_number, mpq_archive)
+	}
+
+	/* check if there is anything to do. */
+	if (count == 0) {
+		return LIBMPQ_SUCCESS;
+	}
+
+	/* allocate memory for the order of the files. */
+	if ((order = malloc(count * sizeof(read_order_s))) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* take position of each packed file. */
+	for (i = 0; i < count; i++) {
+		libmpq__file_offset(mpq_archive, reads[i].file_number, &file_offset);
+		libmpq__file_size_packed(mpq_archive, reads[i].file_number, &order[i].size);
+		order[i].slot   = i;
+		order[i].offset = file_offset + mpq_archive->archive_offset;
+	}
+
+	/* sort files by their position, so the storage is read from front to back. */
+	qsort(order, count, sizeof(read_order_s), libmpq__read_order);
+
+	/* loop through all files. */
+	for (i = 0; i < count; i = j) {
+
+		/* add following files which start close behind, as long as the merged read stays bounded. */
+		start = order[i].offset;
+		end   = start + order[i].size;
+		for (j = i + 1; j < count && order[j].offset <= end + LIBMPQ_MERGE_GAP &&
+		     (order[j].offset + order[j].size > end ? order[j].offset + order[j].size : end) - start <= LIBMPQ_MERGE_MAX; j++) {
+			end = order[j].offset + order[j].size > end ? order[j].offset + order[j].size : end;
+		}
+
+		/* read neighbouring files with one read, a mapped archive needs no read and a file on its own is read the usual way. */
+		merged = j > i + 1 && mpq_archive->io->map == NULL &&
+			 (buffer != NULL || (buffer = malloc(LIBMPQ_MERGE_MAX)) != NULL) &&
+			 libmpq__archive_read(mpq_archive, buffer, end - start, start) == LIBMPQ_SUCCESS;
+
+		/* unpack each file and hand it to the caller. */
+		for (k = i, seen = start; k < j; k++) {
+
+			/* a file overlapping an earlier one shares its packed data, which may be decrypted in place already. */
+			in_data = merged && order[k].offset >= seen ? buffer + (order[k].offset - start) : NULL;
+			seen    = order[k].offset + order[k].size > seen ? order[k].offset + order[k].size : seen;
+
+			/* read file, if the merged read failed each file reports its own error. */
+			entry              = &reads[order[k].slot];
+			entry->transferred = 0;
+			entry->result      = libmpq__file_read_packed(mpq_archive, entry->file_number, in_data, order[k].size, entry->buffer, entry->size, &entry->transferred);
+
+			/* store first error of any file. */
+			if (entry->result < 0 && result == LIBMPQ_SUCCESS) {
+				result = entry->result;
+			}
+
+			/* check if caller wants to know about each finished file. */
+			if (complete != NULL) {
+				complete(entry, data);
+			}
+		}
+	}
 
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
+	/* free merged read and order. */
+	free(buffer);
+	free(order);
+
+	/* return first error of any file. */
+	return result;
 }
 
-/* this function return if the file is encrypted or not. */
-int32_t libmpq__file_encrypted(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t *encrypted) {
+/* this function pass an access hint for the packed data of a file to the storage backend. */
+int32_t libmpq__file_advise(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t advice) {
+
+	/* some common variables. */
+	libmpq__off_t file_offset = 0;
+	libmpq__off_t packed_size = 0;
 
 	/* check if given file number is not out of range. */
 	CHECK_FILE_NUM(file_number, mpq_archive)
 
-	/* return the encryption status of file. */
-	*encrypted = (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_ENCRYPTED) != 0 ? TRUE : FALSE;
-
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
-}
+	/* check if hint is known. */
+	if (advice > LIBMPQ_ADVISE_DONTNEED) {
 
-/* this function return if the file is compressed or not. */
-int32_t libmpq__file_compressed(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t *compressed) {
+		/* unknown hint or archive only flag. */
+		return LIBMPQ_ERROR_SIZE;
+	}
 
-	/* check if given file number is not out of range. */
-	CHECK_FILE_NUM(file_number, mpq_archive)
+	/* get range of packed file. */
+	libmpq__file_offset(mpq_archive, file_number, &file_offset);
+	libmpq__file_size_packed(mpq_archive, file_number, &packed_size);
 
-	/* return the compression status of file. */
-	*compressed = (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_COMPRESS_MULTI) != 0 ? TRUE : FALSE;
+	/* hints are optional, so errors are ignored, an empty range would mean up to the end of storage. */
+	if (mpq_archive->io->advise != NULL && packed_size > 0) {
+		mpq_archive->io->advise(mpq_archive->io_handle, packed_size, file_offset + mpq_archive->archive_offset, advice);
+	}
 
 	/* if no error was found, return zero. */
 	return LIBMPQ_SUCCESS;
 }
 
-/* this function return if the file is imploded or not. */
-int32_t libmpq__file_imploded(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t *imploded) {
+/* range of blocks of a file which is extracted. */
+typedef struct {
+	uint32_t	slot;			/* file the range belongs to. */
+	uint32_t	from;			/* first block of the range. */
+	uint32_t	to;			/* block behind the range. */
+	libmpq__off_t	size;			/* unpacked size of the file, larger files are scheduled first. */
+} extract_range_s;
+
+/* file which is extracted. */
+typedef struct {
+	uint32_t	file_number;		/* file number in the archive. */
+	uint32_t	pending;		/* number of ranges which did not finish yet. */
+	int32_t		result;			/* first error of any range. */
+	uint8_t		*buffer;		/* unpacked file, allocated when its first range starts. */
+	libmpq__off_t	transferred;		/* number of unpacked bytes. */
+} extract_file_s;
+
+/* state shared by the workers of an extraction. */
+typedef struct {
+	mpq_archive_s	*mpq_archive;		/* archive the files belong to. */
+	extract_range_s	*range;			/* ranges ordered by the size of their files. */
+	extract_file_s	*file;			/* files which are extracted. */
+	libmpq__extract_t callback;		/* called for each finished file. */
+	void		*data;			/* argument of the callback. */
+	int32_t		result;			/* first error of any file. */
+	pthread_mutex_t	lock;			/* protects files and result. */
+} extract_s;
+
+/* this function order ranges by the size of their files, largest first, and keep the ranges of a file together. */
+static int libmpq__extract_order(const void *a, const void *b) {
 
-	/* check if given file number is not out of range. */
-	CHECK_FILE_NUM(file_number, mpq_archive)
+	/* some common variables. */
+	const extract_range_s *range_a = a;
+	const extract_range_s *range_b = b;
 
-	/* return the implosion status of file. */
-	*imploded = (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_COMPRESS_PKZIP) != 0 ? TRUE : FALSE;
+	/* larger files first. */
+	if (range_a->size != range_b->size) {
+		return range_a->size > range_b->size ? -1 : 1;
+	}
 
-	/* if no error was found, return zero. */
-	return LIBMPQ_SUCCESS;
+	/* then by file and block. */
+	if (range_a->slot != range_b->slot) {
+		return range_a->slot < range_b->slot ? -1 : 1;
+	}
+	return range_a->from < range_b->from ? -1 : range_a->from > range_b->from;
 }
 
-/* this function return filenumber by the given name. */
-int32_t libmpq__file_number(mpq_archive_s *mpq_archive, const char *filename, uint32_t *number) {
+/* this function unpack one range of a file and hand the file to the callback when its last range finished. */
+static void libmpq__extract_job(void *data, uint32_t index) {
 
 	/* some common variables. */
-	uint32_t i, hash1, hash2, hash3, ht_count;
+	extract_s *extract       = data;
+	extract_range_s *range   = &extract->range[index];
+	extract_file_s *file     = &extract->file[range->slot];
+	mpq_archive_s *mpq_archive = extract->mpq_archive;
+	uint8_t *buffer;
+	uint32_t last;
+	int32_t result;
+	libmpq__off_t file_offset = 0;
+	libmpq__off_t transferred = 0;
+
+	/* lock the extraction. */
+	pthread_mutex_lock(&extract->lock);
+
+	/* allocate file buffer when the first range of the file starts, one extra byte avoids zero sized allocations. */
+	if (file->buffer == NULL && file->result == LIBMPQ_SUCCESS &&
+	    (file->buffer = malloc(range->size + 1)) == NULL) {
 
-	/* if the list of file names doesn't include this one, we'll have
-	 * to figure out the file number the "hard" way.
-	 */
-	ht_count = mpq_archive->mpq_header.hash_table_count;
+		/* memory allocation problem. */
+		file->result = LIBMPQ_ERROR_MALLOC;
+	}
 
-	hash1 = libmpq__hash_string (filename, 0x0) & (ht_count - 1);
-	hash2 = libmpq__hash_string (filename, 0x100);
-	hash3 = libmpq__hash_string (filename, 0x200);
+	/* take buffer, the other ranges only write their own part of it. */
+	result = file->result;
+	buffer = file->buffer;
 
-	/* loop through all files in mpq archive.
-	 * hash1 gives us a clue about the starting position of this
-	 * search.
-	 */
-	for (i = hash1; mpq_archive->mpq_hash[i].block_table_index != LIBMPQ_HASH_FREE; i = (i + 1) & (ht_count - 1)) {
+	/* unlock the extraction. */
+	pthread_mutex_unlock(&extract->lock);
 
-		/* if the other two hashes match, we found our file number. */
-		if (mpq_archive->mpq_hash[i].hash_a == hash2 &&
-		    mpq_archive->mpq_hash[i].hash_b == hash3) {
+	/* check if a range of the file already failed. */
+	if (result == LIBMPQ_SUCCESS && range->to > range->from) {
 
-			/* return the file number. */
-			*number = mpq_archive->mpq_hash[i].block_table_index - mpq_archive->mpq_map[mpq_archive->mpq_hash[i].block_table_index].block_table_diff;
+		/* fetch file offset. */
+		libmpq__file_offset(mpq_archive, file->file_number, &file_offset);
 
-			/* we found our file, return zero. */
-			return LIBMPQ_SUCCESS;
-		}
+		/* open the packed block offset table, ranges of one file share it. */
+		if ((result = libmpq__block_open_offset(mpq_archive, file->file_number)) == LIBMPQ_SUCCESS) {
 
-		/* check if we have cycled through the whole hash table */
-		if (((i + 1) & (ht_count - 1)) == hash1) {
-			break;
+			/* read and unpack range. */
+			result = libmpq__file_read_extent(mpq_archive, file->file_number, range->from, range->to, file_offset, NULL, buffer + (libmpq__off_t)mpq_archive->block_size * range->from, &transferred);
+
+			/* close the packed block offset table. */
+			libmpq__block_close_offset(mpq_archive, file->file_number);
 		}
 	}
 
-	/* if no matching entry found, so return error. */
-	return LIBMPQ_ERROR_EXIST;
+	/* lock the extraction. */
+	pthread_mutex_lock(&extract->lock);
+
+	/* store result of the range. */
+	if (result < 0 && file->result == LIBMPQ_SUCCESS) {
+		file->result = result;
+	}
+	file->transferred += transferred;
+	last = --file->pending == 0;
+
+	/* unlock the extraction. */
+	pthread_mutex_unlock(&extract->lock);
+
+	/* check if other ranges of the file are still running. */
+	if (!last) {
+		return;
+	}
+
+	/* drop packed data behind the read. */
+	libmpq__file_drop(mpq_archive, file->file_number);
+
+	/* hand the file to the caller, no other thread touches it anymore. */
+	extract->callback(file->file_number, file->buffer, file->transferred, file->result, extract->data);
+
+	/* free file buffer. */
+	free(file->buffer);
+	file->buffer = NULL;
+
+	/* store first error of any file. */
+	pthread_mutex_lock(&extract->lock);
+	if (file->result < 0 && extract->result == LIBMPQ_SUCCESS) {
+		extract->result = file->result;
+	}
+	pthread_mutex_unlock(&extract->lock);
 }
 
-/* this function read the given file from archive into a buffer. */
-int32_t libmpq__file_read(mpq_archive_s *mpq_archive, uint32_t file_number, uint8_t *out_buf, libmpq__off_t out_size, libmpq__off_t *transferred) {
+/* this function extract the given files or all files of the archive with the worker threads and hand each one to the callback. */
+int32_t libmpq__archive_extract(mpq_archive_s *mpq_archive, const uint32_t *file_numbers, uint32_t count, libmpq__extract_t callback, void *data) {
 
 	/* some common variables. */
 	uint32_t i;
-	uint32_t blocks         = 0;
-	int32_t result          = 0;
-	libmpq__off_t file_offset       = 0;
-	libmpq__off_t unpacked_size     = 0;
-	libmpq__off_t transferred_block = 0;
-	libmpq__off_t transferred_total = 0;
+	uint32_t blocks;
+	uint32_t ranges = 0;
+	uint32_t from;
+	int32_t result;
+	libmpq__off_t unpacked_size;
+	extract_s extract;
 
-	/* check if given file number is not out of range. */
-	CHECK_FILE_NUM(file_number, mpq_archive)
+	/* check if there is a callback, the unpacked data is only handed out through it. */
+	if (callback == NULL) {
 
-	/* get target size of block. */
-	libmpq__file_size_unpacked(mpq_archive, file_number, &unpacked_size);
+		/* nothing would receive the files. */
+		return LIBMPQ_ERROR_SIZE;
+	}
 
-	/* check if target buffer is to small. */
-	if (unpacked_size > out_size) {
+	/* check if given file numbers are not out of range. */
+	for (i = 0; file_numbers != NULL && i < count; i++) {
+		CHECK_FILE_NUM(file_numbers[i], mpq_archive)
+	}
 
-		/* output buffer size is to small or block size is unknown. */
-		return LIBMPQ_ERROR_SIZE;
+	/* check if all files are extracted. */
+	if (file_numbers == NULL) {
+
+		/* load block table on first use. */
+		if ((result = libmpq__archive_load_block(mpq_archive)) < 0) {
+
+			/* something on reading block table failed. */
+			return result;
+		}
+
+		/* take all files. */
+		count = mpq_archive->files;
 	}
 
-	/* fetch file offset. */
-	libmpq__file_offset(mpq_archive, file_number, &file_offset);
+	/* check if there is anything to do. */
+	if (count == 0) {
+		return LIBMPQ_SUCCESS;
+	}
 
-	/* get block count for file. */
-	libmpq__file_blocks(mpq_archive, file_number, &blocks);
+	/* allocate memory for the files. */
+	if ((extract.file = calloc(count, sizeof(extract_file_s))) == NULL) {
 
-	/* open the packed block offset table. */
-	if ((result = libmpq__block_open_offset(mpq_archive, file_number)) < 0) {
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
 
-		/* something on opening packed block offset table failed. */
-		return result;
+	/* count ranges, large files are split so their blocks are unpacked by many threads. */
+	for (i = 0; i < count; i++) {
+		extract.file[i].file_number = file_numbers != NULL ? file_numbers[i] : i;
+		libmpq__file_blocks(mpq_archive, extract.file[i].file_number, &blocks);
+		extract.file[i].pending = blocks > 0 ? (blocks + LIBMPQ_EXTRACT_BLOCKS - 1) / LIBMPQ_EXTRACT_BLOCKS : 1;
+		ranges += extract.file[i].pending;
 	}
 
-	/* loop through all blocks. */
-	for (i = 0; i < blocks; i++) {
+	/* allocate memory for the ranges. */
+	if ((extract.range = calloc(ranges, sizeof(extract_range_s))) == NULL) {
 
-		/* cleanup size variable. */
-		unpacked_size = 0;
+		/* memory allocation problem. */
+		free(extract.file);
+		return LIBMPQ_ERROR_MALLOC;
+	}
 
-		/* get unpacked block size. */
-		libmpq__block_size_unpacked(mpq_archive, file_number, i, &unpacked_size);
+	/* create ranges. */
+	for (i = 0, ranges = 0; i < count; i++) {
+		libmpq__file_blocks(mpq_archive, extract.file[i].file_number, &blocks);
+		libmpq__file_size_unpacked(mpq_archive, extract.file[i].file_number, &unpacked_size);
+		from = 0;
+		do {
+			extract.range[ranges].slot = i;
+			extract.range[ranges].from = from;
+			extract.range[ranges].to   = blocks - from > LIBMPQ_EXTRACT_BLOCKS ? from + LIBMPQ_EXTRACT_BLOCKS : blocks;
+			extract.range[ranges].size = unpacked_size;
+			from = extract.range[ranges++].to;
+		} while (from < blocks);
+	}
 
-		/* read block. */
-		if ((result = libmpq__block_read(mpq_archive, file_number, i, out_buf + transferred_total, unpacked_size, &transferred_block)) < 0) {
+	/* start with the largest files, so the small ones fill up the end. */
+	qsort(extract.range, ranges, sizeof(extract_range_s), libmpq__extract_order);
 
-			/* close the packed block offset table. */
-			libmpq__block_close_offset(mpq_archive, file_number);
+	/* initialize shared state. */
+	extract.mpq_archive = mpq_archive;
+	extract.callback    = callback;
+	extract.data        = data;
+	extract.result      = LIBMPQ_SUCCESS;
+	pthread_mutex_init(&extract.lock, NULL);
 
-			/* something on reading block failed. */
-			return result;
-		}
+	/* unpack all ranges, idle workers take the next one. */
+	libmpq__pool_run(&mpq_archive->pool, libmpq__extract_job, &extract, ranges);
 
-		transferred_total += transferred_block;
+	/* free state. */
+	pthread_mutex_destroy(&extract.lock);
+	free(extract.range);
+	free(extract.file);
 
-	}
+	/* return first error of any file. */
+	return extract.result;
+}
 
-	/* close the packed block offset table. */
-	libmpq__block_close_offset(mpq_archive, file_number);
+/* this function pass an access hint for the whole archive to the storage backend and remember if files are dropped after they were read. */
+int32_t libmpq__archive_advise(mpq_archive_s *mpq_archive, uint32_t advice) {
 
-	/* check for null pointer. */
-	if (transferred != NULL) {
+	/* check if hint is known. */
+	if ((advice & ~LIBMPQ_ADVISE_DROP) > LIBMPQ_ADVISE_DONTNEED) {
 
-		/* store transferred bytes. */
-		*transferred = transferred_total;
+		/* unknown hint. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* remember flag, readers check it without lock. */
+	__atomic_store_n(&mpq_archive->advice, advice & LIBMPQ_ADVISE_DROP, __ATOMIC_RELAXED);
+
+	/* hints are optional, so errors are ignored, size zero means up to the end of storage. */
+	if (mpq_archive->io->advise != NULL) {
+		mpq_archive->io->advise(mpq_archive->io_handle, 0, mpq_archive->archive_offset, advice & ~LIBMPQ_ADVISE_DROP);
 	}
 
 	/* if no error was found, return zero. */
 	return LIBMPQ_SUCCESS;
 }
 
+/* this function take the kept packed block offset table of a closed file, the archive must be locked. */
+static mpq_file_s *libmpq__file_closed_take(mpq_archive_s *mpq_archive, uint32_t file_number) {
+
+	/* some common variables. */
+	mpq_file_s *mpq_file;
+
+	/* check if table of the file was kept. */
+	if ((mpq_file = mpq_archive->mpq_file_closed[file_number]) == NULL) {
+
+		/* table has to be read. */
+		return NULL;
+	}
+
+	/* unlink from list of closed files. */
+	if (mpq_file->prev != NULL) {
+		mpq_file->prev->next = mpq_file->next;
+	} else {
+		mpq_archive->closed_head = mpq_file->next;
+	}
+	if (mpq_file->next != NULL) {
+		mpq_file->next->prev = mpq_file->prev;
+	} else {
+		mpq_archive->closed_tail = mpq_file->prev;
+	}
+
+	/* table is no longer kept. */
+	mpq_archive->mpq_file_closed[file_number] = NULL;
+	mpq_archive->closed_size                 -= mpq_file->packed_size;
+
+	/* return table. */
+	return mpq_file;
+}
+
+/* this function keep the packed block offset table of a closed file and free the least recently closed ones beyond the limit, the archive must be locked. */
+static void libmpq__file_closed_keep(mpq_archive_s *mpq_archive, mpq_file_s *mpq_file) {
+
+	/* some common variables. */
+	mpq_file_s *oldest;
+
+	/* check if table can be kept at all. */
+	if (mpq_file->packed_size > LIBMPQ_OFFSET_CACHE) {
+
+		/* free packed block offset table and file pointer. */
+		free(mpq_file->packed_offset);
+		free(mpq_file);
+		return;
+	}
+
+	/* free least recently closed tables until the new one fits. */
+	while (mpq_archive->closed_tail != NULL && mpq_archive->closed_size + mpq_file->packed_size > LIBMPQ_OFFSET_CACHE) {
+		oldest = libmpq__file_closed_take(mpq_archive, mpq_archive->closed_tail->file_number);
+		free(oldest->packed_offset);
+		free(oldest);
+	}
+
+	/* put table in front of the list of closed files. */
+	mpq_file->prev = NULL;
+	mpq_file->next = mpq_archive->closed_head;
+	if (mpq_archive->closed_head != NULL) {
+		mpq_archive->closed_head->prev = mpq_file;
+	} else {
+		mpq_archive->closed_tail = mpq_file;
+	}
+	mpq_archive->closed_head                         = mpq_file;
+	mpq_archive->mpq_file_closed[mpq_file->file_number] = mpq_file;
+	mpq_archive->closed_size                        += mpq_file->packed_size;
+}
+
 /* this function open a file in the given archive and caches the block offset information. */
 int32_t libmpq__block_open_offset(mpq_archive_s *mpq_archive, uint32_t file_number) {
 
 	/* some common variables. */
 	uint32_t i;
 	uint32_t packed_size;
-	int32_t rb     = 0;
+	uint32_t seed  = 0;
 	int32_t result = 0;
+	mpq_file_s *mpq_file = NULL;
 
 	/* check if given file number is not out of range. */
 	CHECK_FILE_NUM(file_number, mpq_archive)
 
+	/* lock the opened files, other threads may open or close the same file. */
+	pthread_mutex_lock(&mpq_archive->lock);
+
 	if (mpq_archive->mpq_file[file_number]) {
 
 		/* file already opened, so increment counter */
 		mpq_archive->mpq_file[file_number]->open_count++;
+		pthread_mutex_unlock(&mpq_archive->lock);
 		return LIBMPQ_SUCCESS;
 	}
 
+	/* check if the table was kept when the file was closed, then nothing has to be read or decrypted. */
+	if ((mpq_file = libmpq__file_closed_take(mpq_archive, file_number)) != NULL) {
+
+		/* initialize counter to one opening */
+		mpq_file->open_count = 1;
+		goto publish;
+	}
+
 	/* check if file is not stored in a single sector. */
 	if ((mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_SINGLE) == 0) {
 
@@ -641,7 +2742,7 @@ int32_t libmpq__block_open_offset(mpq_archive_s *mpq_archive, uint32_t file_numb
 	}
 
 	/* allocate memory for the file. */
-	if ((mpq_archive->mpq_file[file_number] = calloc(1, sizeof(mpq_file_s))) == NULL) {
+	if ((mpq_file = calloc(1, sizeof(mpq_file_s))) == NULL) {
 
 		/* memory allocation problem. */
 		result = LIBMPQ_ERROR_MALLOC;
@@ -649,7 +2750,7 @@ int32_t libmpq__block_open_offset(mpq_archive_s *mpq_archive, uint32_t file_numb
 	}
 
 	/* allocate memory for the packed block offset table. */
-	if ((mpq_archive->mpq_file[file_number]->packed_offset = calloc(1, packed_size)) == NULL) {
+	if ((mpq_file->packed_offset = calloc(1, packed_size)) == NULL) {
 
 		/* memory allocation problem. */
 		result = LIBMPQ_ERROR_MALLOC;
@@ -657,35 +2758,37 @@ int32_t libmpq__block_open_offset(mpq_archive_s *mpq_archive, uint32_t file_numb
 	}
 
 	/* initialize counter to one opening */
-	mpq_archive->mpq_file[file_number]->open_count = 1;
+	mpq_file->open_count  = 1;
+	mpq_file->packed_size = packed_size;
+	mpq_file->file_number = file_number;
+
+	/* check if the decoded packed block offset table is stored in the sidecar index. */
+	if (libmpq__index_offset(mpq_archive, file_number, mpq_file->packed_offset, packed_size, &seed) == LIBMPQ_SUCCESS) {
+
+		/* nothing to read or decrypt. */
+		mpq_file->seed = seed;
+		goto publish;
+	}
 
 	/* check if we need to load the packed block offset table, we will maintain this table for unpacked files too. */
 	if ((mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_COMPRESSED) != 0 &&
 	    (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_SINGLE) == 0) {
 
-		/* seek to block position. */
-		if (fseeko(mpq_archive->fp, mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].offset + (((long long)mpq_archive->mpq_block_ex[mpq_archive->mpq_map[file_number].block_table_indices].offset_high) << 32) + mpq_archive->archive_offset, SEEK_SET) < 0) {
-
-			/* seek in file failed. */
-			result = LIBMPQ_ERROR_SEEK;
-			goto error;
-		}
-
 		/* read block positions from begin of file. */
-		if (fread(mpq_archive->mpq_file[file_number]->packed_offset, 1, packed_size, mpq_archive->fp) != packed_size) {
+		if ((result = libmpq__archive_read(mpq_archive, mpq_file->packed_offset, packed_size, mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].offset + (((long long)mpq_archive->mpq_block_ex[mpq_archive->mpq_map[file_number].block_table_indices].offset_high) << 32) + mpq_archive->archive_offset)) < 0) {
 
 			/* something on read from archive failed. */
-			result = LIBMPQ_ERROR_READ;
 			goto error;
 		}
 
 		/* check if the archive is protected some way, sometimes the file appears not to be encrypted, but it is.
 		 * a special case are files with an additional sector but LIBMPQ_FLAG_CRC not set. we don't want to handle
 		 * them as encrypted. */
-		if (mpq_archive->mpq_file[file_number]->packed_offset[0] != packed_size &&
-		    mpq_archive->mpq_file[file_number]->packed_offset[0] != packed_size + 4) {
+		if (mpq_file->packed_offset[0] != packed_size &&
+		    mpq_file->packed_offset[0] != packed_size + 4 &&
+		    (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_ENCRYPTED) == 0) {
 
-			/* file is encrypted. */
+			/* file is encrypted, only written if unknown, because other threads read the flags without lock. */
 			mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags |= LIBMPQ_FLAG_ENCRYPTED;
 		}
 
@@ -693,15 +2796,18 @@ int32_t libmpq__block_open_offset(mpq_archive_s *mpq_archive, uint32_t file_numb
 		if (mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].flags & LIBMPQ_FLAG_ENCRYPTED) {
 
 			/* check if we don't know the file seed, try to find it. */
-			if (libmpq__decrypt_key((uint8_t *)mpq_archive->mpq_file[file_number]->packed_offset, packed_size, mpq_archive->block_size, &mpq_archive->mpq_file[file_number]->seed) < 0) {
+			if (libmpq__decrypt_key((uint8_t *)mpq_file->packed_offset, packed_size, mpq_archive->block_size, &seed) < 0) {
 
 				/* sorry without seed, we cannot extract file. */
 				result = LIBMPQ_ERROR_DECRYPT;
 				goto error;
 			}
 
+			/* store the found seed. */
+			mpq_file->seed = seed;
+
 			/* decrypt block in input buffer. */
-			if (libmpq__decrypt_block(mpq_archive->mpq_file[file_number]->packed_offset, packed_size, mpq_archive->mpq_file[file_number]->seed - 1) < 0 ) {
+			if (libmpq__decrypt_block(mpq_file->packed_offset, packed_size, mpq_file->seed - 1) < 0 ) {
 
 				/* something on decrypt failed. */
 				result = LIBMPQ_ERROR_DECRYPT;
@@ -709,7 +2815,7 @@ int32_t libmpq__block_open_offset(mpq_archive_s *mpq_archive, uint32_t file_numb
 			}
 
 			/* check if the block positions are correctly decrypted. */
-			if (mpq_archive->mpq_file[file_number]->packed_offset[0] != packed_size) {
+			if (mpq_file->packed_offset[0] != packed_size) {
 
 				/* sorry without seed, we cannot extract file. */
 				result = LIBMPQ_ERROR_DECRYPT;
@@ -728,29 +2834,42 @@ int32_t libmpq__block_open_offset(mpq_archive_s *mpq_archive, uint32_t file_numb
 				if (i == ((mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].unpacked_size + mpq_archive->block_size - 1) / mpq_archive->block_size)) {
 
 					/* store size of last block. */
-					mpq_archive->mpq_file[file_number]->packed_offset[i] = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].unpacked_size;
+					mpq_file->packed_offset[i] = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].unpacked_size;
 				} else {
 
 					/* store default block size. */
-					mpq_archive->mpq_file[file_number]->packed_offset[i] = i * mpq_archive->block_size;
+					mpq_file->packed_offset[i] = i * mpq_archive->block_size;
 				}
 			}
 		} else {
 
 			/* store offsets. */
-			mpq_archive->mpq_file[file_number]->packed_offset[0] = 0;
-			mpq_archive->mpq_file[file_number]->packed_offset[1] = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].packed_size;
+			mpq_file->packed_offset[0] = 0;
+			mpq_file->packed_offset[1] = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].packed_size;
 		}
 	}
 
+publish:
+
+	/* publish the opened file, readers only access it after their own open returned. */
+	mpq_archive->mpq_file[file_number] = mpq_file;
+
+	/* unlock the opened files. */
+	pthread_mutex_unlock(&mpq_archive->lock);
+
 	/* if no error was found, return zero. */
 	return LIBMPQ_SUCCESS;
 
 error:
 
+	/* unlock the opened files. */
+	pthread_mutex_unlock(&mpq_archive->lock);
+
 	/* free packed block offset table and file pointer. */
-	free(mpq_archive->mpq_file[file_number]->packed_offset);
-	free(mpq_archive->mpq_file[file_number]);
+	if (mpq_file != NULL) {
+		free(mpq_file->packed_offset);
+	}
+	free(mpq_file);
 
 	/* return error constant. */
 	return result;
@@ -759,30 +2878,40 @@ error:
 /* this function free the file pointer to the opened file in archive. */
 int32_t libmpq__block_close_offset(mpq_archive_s *mpq_archive, uint32_t file_number) {
 
+	/* some common variables. */
+	mpq_file_s *mpq_file;
+
 	/* check if given file number is not out of range. */
 	CHECK_FILE_NUM(file_number, mpq_archive)
 
-	if (mpq_archive->mpq_file[file_number] == NULL) {
+	/* lock the opened files. */
+	pthread_mutex_lock(&mpq_archive->lock);
+
+	if ((mpq_file = mpq_archive->mpq_file[file_number]) == NULL) {
 
 		/* packed block offset table is not opened. */
+		pthread_mutex_unlock(&mpq_archive->lock);
 		return LIBMPQ_ERROR_OPEN;
 	}
 
-	mpq_archive->mpq_file[file_number]->open_count--;
+	mpq_file->open_count--;
 
-	if (mpq_archive->mpq_file[file_number]->open_count != 0) {
+	if (mpq_file->open_count != 0) {
 
 		/* still in use */
+		pthread_mutex_unlock(&mpq_archive->lock);
 		return LIBMPQ_SUCCESS;
 	}
 
-	/* free packed block offset table and file pointer. */
-	free(mpq_archive->mpq_file[file_number]->packed_offset);
-	free(mpq_archive->mpq_file[file_number]);
-
 	/* mark it as unopened - libmpq__block_open_offset checks for this to decide whether to increment the counter */
 	mpq_archive->mpq_file[file_number] = NULL;
 
+	/* keep packed block offset table, so opening the file again needs no read or decryption. */
+	libmpq__file_closed_keep(mpq_archive, mpq_file);
+
+	/* unlock the opened files. */
+	pthread_mutex_unlock(&mpq_archive->lock);
+
 	/* if no error was found, return zero. */
 	return LIBMPQ_SUCCESS;
 }
@@ -859,11 +2988,10 @@ int32_t libmpq__block_read(mpq_archive_s *mpq_archive, uint32_t file_number, uin
 
 	/* some common variables. */
 	uint8_t *in_buf;
-	uint32_t seed       = 0;
+	uint8_t *in_copy    = NULL;
 	uint32_t encrypted  = 0;
-	uint32_t compressed = 0;
-	uint32_t imploded   = 0;
 	int32_t tb          = 0;
+	int32_t result      = 0;
 	libmpq__off_t block_offset  = 0;
 	off_t in_size       = 0;
 	libmpq__off_t unpacked_size = 0;
@@ -892,113 +3020,90 @@ int32_t libmpq__block_read(mpq_archive_s *mpq_archive, uint32_t file_number, uin
 		return LIBMPQ_ERROR_SIZE;
 	}
 
-	/* fetch some required values like input buffer size and block offset. */
-	block_offset = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].offset + (((long long)mpq_archive->mpq_block_ex[mpq_archive->mpq_map[file_number].block_table_indices].offset_high) << 32) + mpq_archive->mpq_file[file_number]->packed_offset[block_number];
-	in_size = mpq_archive->mpq_file[file_number]->packed_offset[block_number + 1] - mpq_archive->mpq_file[file_number]->packed_offset[block_number];
-
-	/* seek in file. */
-	if (fseeko(mpq_archive->fp, block_offset + mpq_archive->archive_offset, SEEK_SET) < 0) {
-
-		/* something with seek in file failed. */
-		return LIBMPQ_ERROR_SEEK;
-	}
-
-	/* allocate memory for the read buffer. */
-	if ((in_buf = calloc(1, in_size)) == NULL) {
-
-		/* memory allocation problem. */
-		return LIBMPQ_ERROR_MALLOC;
-	}
+	/* check if block is cached, then nothing has to be read or unpacked. */
+	if (libmpq__cache_get(&mpq_archive->cache, file_number, block_number, out_buf, out_size, &tb) == LIBMPQ_SUCCESS) {
 
-	/* read block from file. */
-	if (fread(in_buf, 1, in_size, mpq_archive->fp) != in_size) {
+		/* check for null pointer. */
+		if (transferred != NULL) {
 
-		/* free buffers. */
-		free(in_buf);
+			/* store transferred bytes. */
+			*transferred = tb;
+		}
 
-		/* something on reading block failed. */
-		return LIBMPQ_ERROR_READ;
+		/* if no error was found, return zero. */
+		return LIBMPQ_SUCCESS;
 	}
 
-	/* get encryption status. */
-	libmpq__file_encrypted(mpq_archive, file_number, &encrypted);
+	/* fetch some required values like input buffer size and block offset. */
+	block_offset = mpq_archive->mpq_block[mpq_archive->mpq_map[file_number].block_table_indices].offset + (((long long)mpq_archive->mpq_block_ex[mpq_archive->mpq_map[file_number].block_table_indices].offset_high) << 32) + mpq_archive->mpq_file[file_number]->packed_offset[block_number];
+	in_size = mpq_archive->mpq_file[file_number]->packed_offset[block_number + 1] - mpq_archive->mpq_file[file_number]->packed_offset[block_number];
 
-	/* check if file is encrypted. */
-	if (encrypted) {
+	/* check if block is stored, then it is read straight into the output buffer and decrypted there. */
+	if (libmpq__block_stored(mpq_archive, file_number, in_size, unpacked_size)) {
 
-		/* get decryption key. */
-		libmpq__block_seed(mpq_archive, file_number, block_number, &seed);
+		/* read block from file. */
+		if ((result = libmpq__archive_read(mpq_archive, out_buf, in_size, block_offset + mpq_archive->archive_offset)) < 0) {
 
-		/* decrypt block. */
-		if (libmpq__decrypt_block((uint32_t *)in_buf, in_size, seed) < 0) {
+			/* something on reading block failed. */
+			return result;
+		}
 
-			/* free buffers. */
-			free(in_buf);
+		/* decrypt block in place. */
+		if ((result = libmpq__block_decrypt(mpq_archive, file_number, block_number, out_buf, in_size)) < 0) {
 
 			/* something on decrypting block failed. */
-			return LIBMPQ_ERROR_DECRYPT;
+			return result;
 		}
+
+		/* store number of bytes read. */
+		tb = in_size;
+		goto done;
 	}
 
-	/* get compression status. */
-	libmpq__file_compressed(mpq_archive, file_number, &compressed);
+	/* get encryption status. */
+	libmpq__file_encrypted(mpq_archive, file_number, &encrypted);
 
-	/* check if file is compressed. */
-	if (compressed) {
+	/* check if unencrypted block can be used directly from the mapped archive. */
+	if (!encrypted && (in_buf = libmpq__archive_map(mpq_archive, in_size, block_offset + mpq_archive->archive_offset)) != NULL) {
 
-		/* decompress block. */
-		if ((tb = libmpq__decompress_block(in_buf, in_size, out_buf, out_size, LIBMPQ_FLAG_COMPRESS_MULTI)) < 0) {
+		/* no private copy is required. */
+		in_copy = NULL;
+	} else {
 
-			/* free temporary buffer. */
-			free(in_buf);
+		/* take read buffer from the scratch buffers of this thread. */
+		if ((in_buf = in_copy = libmpq__scratch_alloc(LIBMPQ_SCRATCH_PACKED, in_size)) == NULL) {
 
-			/* something on decompressing block failed. */
-			return LIBMPQ_ERROR_UNPACK;
+			/* memory allocation problem. */
+			return LIBMPQ_ERROR_MALLOC;
 		}
-	}
-
-	/* get implosion status. */
-	libmpq__file_imploded(mpq_archive, file_number, &imploded);
 
-	/* check if file is imploded. */
-	if (imploded) {
-
-		/* explode block. */
-		if ((tb = libmpq__decompress_block(in_buf, in_size, out_buf, out_size, LIBMPQ_FLAG_COMPRESS_PKZIP)) < 0) {
+		/* read block from file. */
+		if ((result = libmpq__archive_read(mpq_archive, in_buf, in_size, block_offset + mpq_archive->archive_offset)) < 0) {
 
-			/* free temporary buffer. */
-			free(in_buf);
+			/* release read buffer. */
+			libmpq__scratch_free(LIBMPQ_SCRATCH_PACKED, in_copy);
 
-			/* something on decompressing block failed. */
-			return LIBMPQ_ERROR_UNPACK;
+			/* something on reading block failed. */
+			return result;
 		}
 	}
 
-	/* files should not be compressed and imploded */
-	if (compressed && imploded) {
-		/* free temporary buffer. */
-		free(in_buf);
-
-		/* something on decompressing block failed. */
-		return LIBMPQ_ERROR_UNPACK;
-	}
-
-	/* check if file is neither compressed nor imploded. */
-	if (!compressed && !imploded) {
-
-		/* copy block. */
-		if ((tb = libmpq__decompress_block(in_buf, in_size, out_buf, out_size, LIBMPQ_FLAG_COMPRESS_NONE)) < 0) {
+	/* decrypt and decompress block. */
+	if ((result = libmpq__block_unpack(mpq_archive, file_number, block_number, in_buf, in_size, out_buf, out_size, &tb)) < 0) {
 
-			/* free temporary buffer. */
-			free(in_buf);
+		/* release read buffer. */
+		libmpq__scratch_free(LIBMPQ_SCRATCH_PACKED, in_copy);
 
-			/* something on decompressing block failed. */
-			return LIBMPQ_ERROR_UNPACK;
-		}
+		/* something on unpacking block failed. */
+		return result;
 	}
 
-	/* free read buffer. */
-	free(in_buf);
+	/* release read buffer. */
+	libmpq__scratch_free(LIBMPQ_SCRATCH_PACKED, in_copy);
+
+done:
+	/* remember unpacked block for the next reader. */
+	libmpq__cache_put(&mpq_archive->cache, file_number, block_number, out_buf, tb);
 
 	/* check for null pointer. */
 	if (transferred != NULL) {
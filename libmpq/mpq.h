@@ -55,13 +55,113 @@ extern "C" {
 #define LIBMPQ_ERROR_EXIST			-10		/* file or block does not exist in archive. */
 #define LIBMPQ_ERROR_DECRYPT			-11		/* we don't know the decryption seed. */
 #define LIBMPQ_ERROR_UNPACK			-12		/* error on unpacking file. */
+#define LIBMPQ_ERROR_CANCEL			-13		/* request was cancelled. */
+
+/* define flags for opening archives. */
+#define LIBMPQ_OPEN_MMAP			0x00000001	/* map archive into memory instead of reading from the file. */
+#define LIBMPQ_OPEN_URING			0x00000002	/* read sectors with io_uring where available. */
+#define LIBMPQ_OPEN_LAZY			0x00000004	/* read hash and block table on first use instead of on open. */
+
+/* define access hints for archives and files, passed to the kernel by the built-in storage backends. */
+#define LIBMPQ_ADVISE_NORMAL			0		/* no special access pattern. */
+#define LIBMPQ_ADVISE_SEQUENTIAL		1		/* data is read in order, like by bulk extraction. */
+#define LIBMPQ_ADVISE_RANDOM			2		/* data is read in random order, kernel readahead is useless. */
+#define LIBMPQ_ADVISE_WILLNEED			3		/* data is read soon. */
+#define LIBMPQ_ADVISE_DONTNEED			4		/* data is not read again soon. */
+#define LIBMPQ_ADVISE_DROP			0x00000100	/* archive only, drop files from the page cache after they were read whole. */
+
+/* define priority classes of queued reads, lower classes run first. */
+#define LIBMPQ_PRIORITY_URGENT			0		/* reads the caller is blocked on. */
+#define LIBMPQ_PRIORITY_HIGH			1		/* reads needed soon. */
+#define LIBMPQ_PRIORITY_NORMAL			2		/* reads without special needs. */
+#define LIBMPQ_PRIORITY_BACKGROUND		3		/* prefetching and other speculative reads. */
+#define LIBMPQ_PRIORITY_CLASSES			4		/* number of priority classes. */
 
 /* internal data structure. */
 typedef struct mpq_archive mpq_archive_s;
 
+/* file handle for reading a file piece by piece. */
+typedef struct mpq_stream mpq_stream_s;
+
+/* queue for asynchronous reads. */
+typedef struct mpq_queue mpq_queue_s;
+
 /* file offset data type for API*/
 typedef int64_t libmpq__off_t;
 
+/* single read request, used for batched reads from the archive storage. */
+typedef struct {
+	libmpq__off_t	offset;			/* absolute offset in the archive storage. */
+	libmpq__off_t	size;			/* number of bytes to read. */
+	void		*buffer;		/* buffer which receives the data. */
+	int32_t		result;			/* zero or error constant, set when the request finished. */
+	void		*data;			/* caller data, never touched by the storage backend. */
+} libmpq__io_request_s;
+
+/* output segment of a scattered file read. */
+typedef struct {
+	void		*buffer;		/* buffer which receives the data. */
+	libmpq__off_t	size;			/* size of the buffer. */
+} libmpq__iovec_s;
+
+/* callback for each finished request of a batch, may be called from any thread. */
+typedef void (*libmpq__io_complete_t)(libmpq__io_request_s *request, void *data);
+
+/* single file of a batched read. */
+typedef struct {
+	uint32_t	file_number;		/* file which is read. */
+	uint8_t		*buffer;		/* buffer which receives the unpacked file. */
+	libmpq__off_t	size;			/* size of the buffer. */
+	libmpq__off_t	transferred;		/* number of unpacked bytes, set when the file finished. */
+	int32_t		result;			/* zero or error constant, set when the file finished. */
+	void		*data;			/* caller data, never touched by the library. */
+} libmpq__read_s;
+
+/* callback for each finished file of a batched read, called by the thread which started the batch. */
+typedef void (*libmpq__read_complete_t)(libmpq__read_s *entry, void *data);
+
+/* finished request of a queue. */
+typedef struct {
+	uint64_t	ticket;			/* ticket handed out when the request was submitted. */
+	uint32_t	file_number;		/* file which was read. */
+	libmpq__off_t	offset;			/* position of the range in the unpacked file. */
+	uint8_t		*buffer;		/* buffer which received the data. */
+	libmpq__off_t	transferred;		/* number of bytes read. */
+	int32_t		result;			/* zero or error constant, LIBMPQ_ERROR_CANCEL if the request was cancelled. */
+	void		*data;			/* caller data given on submit. */
+} libmpq__completion_s;
+
+/* counters of one priority class of a queue. */
+typedef struct {
+	uint64_t	completed;		/* requests which finished, with or without error. */
+	uint64_t	cancelled;		/* requests which were cancelled. */
+	uint64_t	missed;			/* completed requests which finished after their deadline. */
+	uint64_t	latency_total;		/* sum of the time from submit to finish of completed requests in microseconds. */
+	uint64_t	latency_max;		/* longest time from submit to finish of a completed request in microseconds. */
+} libmpq__queue_stats_s;
+
+/* callback for each extracted file, may be called from any thread, buffer is freed when it returns. */
+typedef void (*libmpq__extract_t)(uint32_t file_number, const uint8_t *buffer, libmpq__off_t size, int32_t result, void *data);
+
+/*
+ *  storage backend for archives, all functions return zero or an error constant
+ *  and must be safe to call from multiple threads at the same time. read has to
+ *  return all requested bytes or fail. prefetch, read_batch, map and advise are
+ *  optional and may be NULL. struct_size must be set to sizeof(libmpq__io_s),
+ *  members which are not covered by it are treated as NULL, so backends built
+ *  against an older header keep working when members are appended.
+ */
+typedef struct {
+	uint32_t	struct_size;		/* size of the structure known to the caller. */
+	int32_t		(*read)(void *handle, void *buffer, libmpq__off_t size, libmpq__off_t offset);
+	int32_t		(*size)(void *handle, libmpq__off_t *size);
+	int32_t		(*close)(void *handle);
+	int32_t		(*prefetch)(void *handle, libmpq__off_t size, libmpq__off_t offset);
+	int32_t		(*read_batch)(void *handle, libmpq__io_request_s *requests, uint32_t count, libmpq__io_complete_t complete, void *data);
+	const void	*(*map)(void *handle, libmpq__off_t size, libmpq__off_t offset);
+	int32_t		(*advise)(void *handle, libmpq__off_t size, libmpq__off_t offset, uint32_t advice);
+} libmpq__io_s;
+
 /* generic information about library. */
 extern LIBMPQ_API const char *libmpq__version(void);
 
@@ -70,12 +170,21 @@ extern LIBMPQ_API const char *libmpq__strerror(int32_t returncode);
 
 /* generic mpq archive information. */
 extern LIBMPQ_API int32_t libmpq__archive_open(mpq_archive_s **mpq_archive, const char *mpq_filename, libmpq__off_t archive_offset);
+extern LIBMPQ_API int32_t libmpq__archive_open_flags(mpq_archive_s **mpq_archive, const char *mpq_filename, libmpq__off_t archive_offset, uint32_t flags);
+extern LIBMPQ_API int32_t libmpq__archive_open_memory(mpq_archive_s **mpq_archive, const void *buffer, libmpq__off_t buffer_size, libmpq__off_t archive_offset);
+extern LIBMPQ_API int32_t libmpq__archive_open_io(mpq_archive_s **mpq_archive, const libmpq__io_s *io, void *handle, libmpq__off_t archive_offset, uint32_t flags);
+extern LIBMPQ_API int32_t libmpq__archive_open_index(mpq_archive_s **mpq_archive, const char *mpq_filename, const char *index_filename, libmpq__off_t archive_offset, uint32_t flags);
 extern LIBMPQ_API int32_t libmpq__archive_close(mpq_archive_s *mpq_archive);
 extern LIBMPQ_API int32_t libmpq__archive_size_packed(mpq_archive_s *mpq_archive, libmpq__off_t *packed_size);
 extern LIBMPQ_API int32_t libmpq__archive_size_unpacked(mpq_archive_s *mpq_archive, libmpq__off_t *unpacked_size);
 extern LIBMPQ_API int32_t libmpq__archive_offset(mpq_archive_s *mpq_archive, libmpq__off_t *offset);
 extern LIBMPQ_API int32_t libmpq__archive_version(mpq_archive_s *mpq_archive, uint32_t *version);
 extern LIBMPQ_API int32_t libmpq__archive_files(mpq_archive_s *mpq_archive, uint32_t *files);
+extern LIBMPQ_API int32_t libmpq__archive_cache(mpq_archive_s *mpq_archive, libmpq__off_t cache_size);
+extern LIBMPQ_API int32_t libmpq__archive_cache_stats(mpq_archive_s *mpq_archive, uint64_t *hits, uint64_t *misses, libmpq__off_t *cache_used);
+extern LIBMPQ_API int32_t libmpq__archive_threads(mpq_archive_s *mpq_archive, uint32_t threads);
+extern LIBMPQ_API int32_t libmpq__archive_extract(mpq_archive_s *mpq_archive, const uint32_t *file_numbers, uint32_t count, libmpq__extract_t callback, void *data);
+extern LIBMPQ_API int32_t libmpq__archive_advise(mpq_archive_s *mpq_archive, uint32_t advice);
 
 /* generic file processing functions. */
 extern LIBMPQ_API int32_t libmpq__file_size_packed(mpq_archive_s *mpq_archive, uint32_t file_number, libmpq__off_t *packed_size);
@@ -87,6 +196,29 @@ extern LIBMPQ_API int32_t libmpq__file_compressed(mpq_archive_s *mpq_archive, ui
 extern LIBMPQ_API int32_t libmpq__file_imploded(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t *imploded);
 extern LIBMPQ_API int32_t libmpq__file_number(mpq_archive_s *mpq_archive, const char *filename, uint32_t *number);
 extern LIBMPQ_API int32_t libmpq__file_read(mpq_archive_s *mpq_archive, uint32_t file_number, uint8_t *out_buf, libmpq__off_t out_size, libmpq__off_t *transferred);
+extern LIBMPQ_API int32_t libmpq__file_read_range(mpq_archive_s *mpq_archive, uint32_t file_number, libmpq__off_t offset, uint8_t *out_buf, libmpq__off_t out_size, libmpq__off_t *transferred);
+extern LIBMPQ_API int32_t libmpq__file_read_vector(mpq_archive_s *mpq_archive, uint32_t file_number, const libmpq__iovec_s *iov, uint32_t count, libmpq__off_t *transferred);
+extern LIBMPQ_API int32_t libmpq__file_extract_fd(mpq_archive_s *mpq_archive, uint32_t file_number, int fd, libmpq__off_t *transferred);
+extern LIBMPQ_API int32_t libmpq__file_read_many(mpq_archive_s *mpq_archive, libmpq__read_s *reads, uint32_t count, libmpq__read_complete_t complete, void *data);
+extern LIBMPQ_API int32_t libmpq__file_advise(mpq_archive_s *mpq_archive, uint32_t file_number, uint32_t advice);
+
+/* generic file handle functions. */
+extern LIBMPQ_API int32_t libmpq__stream_open(mpq_archive_s *mpq_archive, uint32_t file_number, mpq_stream_s **mpq_stream);
+extern LIBMPQ_API int32_t libmpq__stream_read(mpq_stream_s *mpq_stream, uint8_t *out_buf, libmpq__off_t out_size, libmpq__off_t *transferred);
+extern LIBMPQ_API int32_t libmpq__stream_readahead(mpq_stream_s *mpq_stream, uint32_t blocks);
+extern LIBMPQ_API int32_t libmpq__stream_seek(mpq_stream_s *mpq_stream, libmpq__off_t offset);
+extern LIBMPQ_API int32_t libmpq__stream_tell(mpq_stream_s *mpq_stream, libmpq__off_t *offset);
+extern LIBMPQ_API int32_t libmpq__stream_close(mpq_stream_s *mpq_stream);
+
+/* generic asynchronous read functions. */
+extern LIBMPQ_API int32_t libmpq__queue_open(mpq_archive_s *mpq_archive, uint32_t threads, mpq_queue_s **mpq_queue);
+extern LIBMPQ_API int32_t libmpq__queue_read(mpq_queue_s *mpq_queue, uint32_t file_number, libmpq__off_t offset, uint8_t *out_buf, libmpq__off_t out_size, void *data, uint64_t *ticket);
+extern LIBMPQ_API int32_t libmpq__queue_read_priority(mpq_queue_s *mpq_queue, uint32_t file_number, libmpq__off_t offset, uint8_t *out_buf, libmpq__off_t out_size, uint32_t priority, uint64_t deadline, void *data, uint64_t *ticket);
+extern LIBMPQ_API int32_t libmpq__queue_cancel(mpq_queue_s *mpq_queue, uint64_t ticket);
+extern LIBMPQ_API int32_t libmpq__queue_poll(mpq_queue_s *mpq_queue, libmpq__completion_s *completion);
+extern LIBMPQ_API int32_t libmpq__queue_wait(mpq_queue_s *mpq_queue, libmpq__completion_s *completion);
+extern LIBMPQ_API int32_t libmpq__queue_stats(mpq_queue_s *mpq_queue, uint32_t priority, libmpq__queue_stats_s *stats);
+extern LIBMPQ_API int32_t libmpq__queue_close(mpq_queue_s *mpq_queue);
 
 /* generic block processing functions. */
 extern LIBMPQ_API int32_t libmpq__block_open_offset(mpq_archive_s *mpq_archive, uint32_t file_number);
@@ -25,4 +25,25 @@
   #define fseeko _fseeki64
 #endif
 
+/* windows needs binary mode for open(), everybody else ignores it. */
+#ifndef O_BINARY
+  #define O_BINARY 0
+#endif
+
+/* positional read for systems without pread, it never moves the file position. */
+#if defined(_WIN32) && !defined(HAVE_PREAD)
+  #include <io.h>
+  #include <windows.h>
+  static __inline ssize_t pread(int fd, void *buf, size_t count, int64_t offset) {
+	OVERLAPPED ov = {0};
+	DWORD rb      = 0;
+	ov.Offset     = (DWORD)offset;
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+	if (!ReadFile((HANDLE)_get_osfhandle(fd), buf, (DWORD)count, &rb, &ov)) {
+		return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+	}
+	return rb;
+  }
+#endif
+
 #endif								/* _PLATFORM_H */
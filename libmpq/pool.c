@@ -0,0 +1,294 @@
+/*
+ *  pool.c -- worker threads which unpack the blocks of one file at the
+ *            same time.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* mpq-tools configuration includes. */
+#include "config.h"
+
+/* libmpq main includes. */
+#include "mpq.h"
+#include "mpq-internal.h"
+
+/* libmpq generic includes. */
+#include "pool.h"
+
+/* generic includes. */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* this function take indices of posted jobs until the pool is stopped. */
+static void *libmpq__pool_worker(void *ptr) {
+
+	/* some common variables. */
+	mpq_pool_s *pool = ptr;
+	libmpq__pool_job_t job;
+	void *data;
+	uint32_t index;
+
+	/* lock the pool. */
+	pthread_mutex_lock(&pool->lock);
+
+	/* loop until the pool is stopped. */
+	while (TRUE) {
+
+		/* wait for a job with indices which are not taken yet. */
+		while (!pool->stop && (!pool->busy || pool->next >= pool->count)) {
+			pthread_cond_wait(&pool->work, &pool->lock);
+		}
+
+		/* check if worker has to exit. */
+		if (pool->stop) {
+			break;
+		}
+
+		/* take next index. */
+		index = pool->next++;
+		job   = pool->job;
+		data  = pool->data;
+
+		/* run job without lock, so other workers can take indices meanwhile. */
+		pthread_mutex_unlock(&pool->lock);
+		job(data, index);
+		pthread_mutex_lock(&pool->lock);
+
+		/* wake up the caller if this was the last index. */
+		if (--pool->pending == 0) {
+			pthread_cond_broadcast(&pool->done);
+		}
+	}
+
+	/* unlock the pool. */
+	pthread_mutex_unlock(&pool->lock);
+
+	/* worker finished. */
+	return NULL;
+}
+
+/* this function stop and join all worker threads, the resize lock must be held. */
+static void libmpq__pool_stop(mpq_pool_s *pool) {
+
+	/* some common variables. */
+	pthread_t *thread;
+	uint32_t threads;
+	uint32_t i;
+
+	/* lock the pool. */
+	pthread_mutex_lock(&pool->lock);
+
+	/* wait until the running job finished, its caller relies on the workers. */
+	while (pool->busy) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+
+	/* take workers away from the pool, so new jobs are run by their callers. */
+	thread        = pool->thread;
+	threads       = pool->threads;
+	pool->thread  = NULL;
+	pool->stop    = TRUE;
+	__atomic_store_n(&pool->threads, 0, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&pool->work);
+
+	/* unlock the pool, workers need the lock to exit. */
+	pthread_mutex_unlock(&pool->lock);
+
+	/* wait for all workers. */
+	for (i = 0; i < threads; i++) {
+		pthread_join(thread[i], NULL);
+	}
+	free(thread);
+
+	/* pool can be started again. */
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = FALSE;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* this function initialize a pool without threads. */
+int32_t libmpq__pool_init(mpq_pool_s *pool) {
+
+	/* cleanup all members. */
+	memset(pool, 0, sizeof(mpq_pool_s));
+
+	/* initialize locks and conditions. */
+	if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+		return LIBMPQ_ERROR_MALLOC;
+	}
+	if (pthread_mutex_init(&pool->resize, NULL) != 0) {
+		pthread_mutex_destroy(&pool->lock);
+		return LIBMPQ_ERROR_MALLOC;
+	}
+	if (pthread_cond_init(&pool->work, NULL) != 0) {
+		pthread_mutex_destroy(&pool->resize);
+		pthread_mutex_destroy(&pool->lock);
+		return LIBMPQ_ERROR_MALLOC;
+	}
+	if (pthread_cond_init(&pool->done, NULL) != 0) {
+		pthread_cond_destroy(&pool->work);
+		pthread_mutex_destroy(&pool->resize);
+		pthread_mutex_destroy(&pool->lock);
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function stop all threads and free the pool itself. */
+void libmpq__pool_free(mpq_pool_s *pool) {
+
+	/* stop workers. */
+	pthread_mutex_lock(&pool->resize);
+	libmpq__pool_stop(pool);
+	pthread_mutex_unlock(&pool->resize);
+
+	/* free locks and conditions. */
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->resize);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+/* this function replace the worker threads, zero stops all of them. */
+int32_t libmpq__pool_threads(mpq_pool_s *pool, uint32_t threads) {
+
+	/* some common variables. */
+	pthread_t *thread;
+	uint32_t i;
+
+	/* only one caller may replace the workers at a time. */
+	pthread_mutex_lock(&pool->resize);
+
+	/* stop old workers. */
+	libmpq__pool_stop(pool);
+
+	/* check if pool stays disabled. */
+	if (threads == 0) {
+		pthread_mutex_unlock(&pool->resize);
+		return LIBMPQ_SUCCESS;
+	}
+
+	/* allocate memory for the thread list. */
+	if ((thread = calloc(threads, sizeof(pthread_t))) == NULL) {
+
+		/* memory allocation problem. */
+		pthread_mutex_unlock(&pool->resize);
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* start new workers. */
+	for (i = 0; i < threads; i++) {
+
+		/* check if thread could be created. */
+		if (pthread_create(&thread[i], NULL, libmpq__pool_worker, pool) != 0) {
+
+			/* hand over the started workers, so they are stopped like a complete pool. */
+			pthread_mutex_lock(&pool->lock);
+			pool->thread  = thread;
+			__atomic_store_n(&pool->threads, i, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&pool->lock);
+			libmpq__pool_stop(pool);
+			pthread_mutex_unlock(&pool->resize);
+
+			/* thread resources are exhausted. */
+			return LIBMPQ_ERROR_MALLOC;
+		}
+	}
+
+	/* publish workers. */
+	pthread_mutex_lock(&pool->lock);
+	pool->thread  = thread;
+	__atomic_store_n(&pool->threads, threads, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&pool->lock);
+
+	/* unlock resizing. */
+	pthread_mutex_unlock(&pool->resize);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the number of worker threads, callers use it to decide how to split work. */
+uint32_t libmpq__pool_size(mpq_pool_s *pool) {
+
+	/* read without lock, the number only changes when the workers are replaced. */
+	return __atomic_load_n(&pool->threads, __ATOMIC_RELAXED);
+}
+
+/* this function call job for each index from zero to count - 1 and return when all calls finished. */
+void libmpq__pool_run(mpq_pool_s *pool, libmpq__pool_job_t job, void *data, uint32_t count) {
+
+	/* some common variables. */
+	uint32_t index;
+
+	/* lock the pool. */
+	pthread_mutex_lock(&pool->lock);
+
+	/* check if pool is disabled, busy with another caller or the job is too small to share. */
+	if (pool->threads == 0 || pool->busy || count < 2) {
+
+		/* unlock the pool. */
+		pthread_mutex_unlock(&pool->lock);
+
+		/* run all indices ourself. */
+		for (index = 0; index < count; index++) {
+			job(data, index);
+		}
+
+		/* all calls finished. */
+		return;
+	}
+
+	/* post job to the workers. */
+	pool->job     = job;
+	pool->data    = data;
+	pool->count   = count;
+	pool->next    = 0;
+	pool->pending = count;
+	pool->busy    = TRUE;
+	pthread_cond_broadcast(&pool->work);
+
+	/* take indices like any worker. */
+	while (pool->next < count) {
+
+		/* take next index. */
+		index = pool->next++;
+
+		/* run job without lock. */
+		pthread_mutex_unlock(&pool->lock);
+		job(data, index);
+		pthread_mutex_lock(&pool->lock);
+
+		/* one index less. */
+		pool->pending--;
+	}
+
+	/* wait until the workers finished their indices. */
+	while (pool->pending > 0) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+
+	/* pool is free for the next job, wake up callers which wait for it. */
+	pool->busy = FALSE;
+	pthread_cond_broadcast(&pool->done);
+
+	/* unlock the pool. */
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,57 @@
+/*
+ *  pool.h -- header for the worker threads which unpack the blocks of one
+ *            file at the same time.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+/* define pool information. */
+#define LIBMPQ_POOL_THREADS_MAX			256		/* maximum number of worker threads. */
+
+/* initialize a pool without threads. */
+int32_t libmpq__pool_init(
+	mpq_pool_s		*pool
+);
+
+/* stop all threads and free the pool itself. */
+void libmpq__pool_free(
+	mpq_pool_s		*pool
+);
+
+/* replace the worker threads, zero stops all of them. */
+int32_t libmpq__pool_threads(
+	mpq_pool_s		*pool,
+	uint32_t		threads
+);
+
+/* return the number of worker threads, zero if the pool is disabled. */
+uint32_t libmpq__pool_size(
+	mpq_pool_s		*pool
+);
+
+/* call job for each index from zero to count - 1 and return when all calls finished. */
+void libmpq__pool_run(
+	mpq_pool_s		*pool,
+	libmpq__pool_job_t	job,
+	void			*data,
+	uint32_t		count
+);
+
+#endif						/* _POOL_H */
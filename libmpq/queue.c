@@ -0,0 +1,662 @@
+/*
+ *  queue.c -- asynchronous reads, requests are run by worker threads of
+ *             the queue in order of priority and deadline and their
+ *             completions are collected by the caller.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* mpq-tools configuration includes. */
+#include "config.h"
+
+/* libmpq main includes. */
+#include "mpq.h"
+#include "mpq-internal.h"
+
+/* libmpq generic includes. */
+#include "pool.h"
+
+/* generic includes. */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* define scheduling of requests. */
+#define LIBMPQ_QUEUE_SLICE_BLOCKS		16		/* blocks read at once before a more urgent request may run. */
+#define LIBMPQ_QUEUE_STARVE			250000		/* microseconds a request may wait before it runs ahead of more urgent ones. */
+#define LIBMPQ_QUEUE_NO_DEADLINE		UINT64_MAX	/* deadline of requests without one. */
+
+/* submitted request of a queue. */
+typedef struct mpq_request mpq_request_s;
+struct mpq_request {
+	mpq_request_s	*next;			/* next request in the same list. */
+	mpq_request_s	*older;			/* request of the same class which was queued before, only used while pending. */
+	mpq_request_s	*newer;			/* request of the same class which was queued after, only used while pending. */
+	libmpq__completion_s completion;	/* request as handed back to the caller. */
+	uint32_t	priority;		/* priority class. */
+	uint32_t	cancel;			/* set if request was cancelled while a worker read a slice of it. */
+	uint64_t	submitted;		/* time of submit in microseconds. */
+	uint64_t	queued;			/* time the request was queued the last time in microseconds. */
+	uint64_t	deadline;		/* absolute deadline in microseconds. */
+	libmpq__off_t	block_size;		/* unpacked size of all blocks but the last one. */
+	libmpq__off_t	position;		/* next byte of the file which is read. */
+	libmpq__off_t	end;			/* end of the range, clipped at the end of file. */
+};
+
+/* list of requests, first in first out. */
+typedef struct {
+	mpq_request_s	*head;			/* oldest request. */
+	mpq_request_s	*tail;			/* newest request. */
+} mpq_request_list_s;
+
+/* pending requests of one class in the order they were queued, the oldest is checked for starvation. */
+typedef struct {
+	mpq_request_s	*oldest;		/* request which waits longest. */
+	mpq_request_s	*newest;		/* request which was queued last. */
+} mpq_request_age_s;
+
+/* queue with its own worker threads. */
+struct mpq_queue {
+	mpq_archive_s	*mpq_archive;		/* archive all requests read from. */
+	pthread_mutex_t	lock;			/* protects all members below. */
+	pthread_cond_t	work;			/* signalled when a request was submitted or the queue is closed. */
+	pthread_cond_t	done;			/* signalled when a request finished. */
+	pthread_t	*thread;		/* worker threads. */
+	uint32_t	threads;		/* number of worker threads. */
+	uint32_t	stop;			/* set when workers have to exit. */
+	uint32_t	outstanding;		/* requests which were submitted and not collected yet. */
+	uint64_t	ticket;			/* last handed out ticket. */
+	mpq_request_list_s pending[LIBMPQ_PRIORITY_CLASSES];	/* requests waiting for a worker, ordered by deadline. */
+	mpq_request_age_s waiting[LIBMPQ_PRIORITY_CLASSES];	/* the same requests, ordered by the time they were queued. */
+	mpq_request_list_s running;		/* requests of which a worker reads a slice. */
+	mpq_request_list_s finished;		/* requests which finished and were not collected yet. */
+	mpq_request_s	*spare;			/* collected requests, kept for the next submit. */
+	libmpq__queue_stats_s stats[LIBMPQ_PRIORITY_CLASSES];	/* counters of each priority class. */
+};
+
+/* this function return the time of a monotonic clock in microseconds. */
+static uint64_t libmpq__queue_now(void) {
+
+	/* some common variables. */
+	struct timespec ts;
+
+	/* read clock, which never jumps. */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	/* return microseconds. */
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* this function append a request to the end of a list. */
+static void libmpq__request_push(mpq_request_list_s *list, mpq_request_s *request) {
+
+	/* append request. */
+	request->next = NULL;
+	if (list->tail != NULL) {
+		list->tail->next = request;
+	} else {
+		list->head = request;
+	}
+	list->tail = request;
+}
+
+/* this function insert a request behind all requests with the same or an earlier deadline. */
+static void libmpq__request_insert(mpq_request_list_s *list, mpq_request_s *request) {
+
+	/* some common variables. */
+	mpq_request_s **link = &list->head;
+
+	/* find place of request, requests with the same deadline keep their order. */
+	while (*link != NULL && (*link)->deadline <= request->deadline) {
+		link = &(*link)->next;
+	}
+
+	/* link request. */
+	request->next = *link;
+	*link         = request;
+	if (request->next == NULL) {
+		list->tail = request;
+	}
+}
+
+/* this function unlink a request from a list. */
+static void libmpq__request_remove(mpq_request_list_s *list, mpq_request_s *request) {
+
+	/* some common variables. */
+	mpq_request_s **link = &list->head;
+	mpq_request_s *prev  = NULL;
+
+	/* find request. */
+	while (*link != request) {
+		prev = *link;
+		link = &(*link)->next;
+	}
+
+	/* unlink request. */
+	*link = request->next;
+	if (list->tail == request) {
+		list->tail = prev;
+	}
+}
+
+/* this function remove the oldest request of a list, NULL if it is empty. */
+static mpq_request_s *libmpq__request_pop(mpq_request_list_s *list) {
+
+	/* some common variables. */
+	mpq_request_s *request = list->head;
+
+	/* unlink request. */
+	if (request != NULL && (list->head = request->next) == NULL) {
+		list->tail = NULL;
+	}
+
+	/* return request. */
+	return request;
+}
+
+/* this function make a request pending, the queue must be locked. */
+static void libmpq__queue_enqueue(mpq_queue_s *mpq_queue, mpq_request_s *request) {
+
+	/* some common variables. */
+	mpq_request_age_s *age = &mpq_queue->waiting[request->priority];
+
+	/* stamp request, it is the newest of its class. */
+	request->queued = libmpq__queue_now();
+	request->older  = age->newest;
+	request->newer  = NULL;
+	if (age->newest != NULL) {
+		age->newest->newer = request;
+	} else {
+		age->oldest = request;
+	}
+	age->newest = request;
+
+	/* insert request by deadline. */
+	libmpq__request_insert(&mpq_queue->pending[request->priority], request);
+}
+
+/* this function take a request out of the pending lists, the queue must be locked. */
+static void libmpq__queue_dequeue(mpq_queue_s *mpq_queue, mpq_request_s *request) {
+
+	/* some common variables. */
+	mpq_request_age_s *age = &mpq_queue->waiting[request->priority];
+
+	/* unlink request from the age order. */
+	if (request->older != NULL) {
+		request->older->newer = request->newer;
+	} else {
+		age->oldest = request->newer;
+	}
+	if (request->newer != NULL) {
+		request->newer->older = request->older;
+	} else {
+		age->newest = request->older;
+	}
+
+	/* unlink request from the deadline order. */
+	libmpq__request_remove(&mpq_queue->pending[request->priority], request);
+}
+
+/* this function free all requests of a list. */
+static void libmpq__request_free(mpq_request_s *request) {
+
+	/* some common variables. */
+	mpq_request_s *next;
+
+	/* free requests. */
+	for (; request != NULL; request = next) {
+		next = request->next;
+		free(request);
+	}
+}
+
+/* this function take the request which has to run next, the queue must be locked. */
+static mpq_request_s *libmpq__queue_pick(mpq_queue_s *mpq_queue) {
+
+	/* some common variables. */
+	mpq_request_s *request;
+	mpq_request_s *pick = NULL;
+	uint64_t now        = libmpq__queue_now();
+	uint32_t i;
+
+	/* take the request of a less urgent class which waited longest, if it waited too long, only the oldest of each class has to be checked. */
+	for (i = 1; i < LIBMPQ_PRIORITY_CLASSES; i++) {
+		request = mpq_queue->waiting[i].oldest;
+		if (request != NULL && now - request->queued > LIBMPQ_QUEUE_STARVE && (pick == NULL || request->queued < pick->queued)) {
+			pick = request;
+		}
+	}
+
+	/* otherwise take the most urgent class, earliest deadline first. */
+	for (i = 0; pick == NULL && i < LIBMPQ_PRIORITY_CLASSES; i++) {
+		pick = mpq_queue->pending[i].head;
+	}
+
+	/* check if request was found. */
+	if (pick != NULL) {
+		libmpq__queue_dequeue(mpq_queue, pick);
+	}
+
+	/* return request. */
+	return pick;
+}
+
+/* this function hand a request to the caller and count it, the queue must be locked. */
+static void libmpq__queue_finish(mpq_queue_s *mpq_queue, mpq_request_s *request) {
+
+	/* some common variables. */
+	libmpq__queue_stats_s *stats = &mpq_queue->stats[request->priority];
+	uint64_t now                 = libmpq__queue_now();
+
+	/* count request. */
+	if (request->completion.result == LIBMPQ_ERROR_CANCEL) {
+		stats->cancelled++;
+	} else {
+		stats->completed++;
+		stats->latency_total += now - request->submitted;
+		stats->latency_max    = now - request->submitted > stats->latency_max ? now - request->submitted : stats->latency_max;
+		stats->missed        += now > request->deadline;
+	}
+
+	/* hand request to the caller. */
+	libmpq__request_push(&mpq_queue->finished, request);
+	pthread_cond_broadcast(&mpq_queue->done);
+}
+
+/* this function take pending requests and read them slice by slice until the queue is closed. */
+static void *libmpq__queue_worker(void *ptr) {
+
+	/* some common variables. */
+	mpq_queue_s *mpq_queue = ptr;
+	mpq_request_s *request = NULL;
+	libmpq__completion_s *completion;
+	int32_t result;
+	libmpq__off_t length;
+	libmpq__off_t tb;
+
+	/* lock the queue. */
+	pthread_mutex_lock(&mpq_queue->lock);
+
+	/* loop until the queue is closed. */
+	while (TRUE) {
+
+		/* wait for a request. */
+		while (!mpq_queue->stop && (request = libmpq__queue_pick(mpq_queue)) == NULL) {
+			pthread_cond_wait(&mpq_queue->work, &mpq_queue->lock);
+		}
+
+		/* check if worker has to exit. */
+		if (mpq_queue->stop) {
+			break;
+		}
+
+		/* read up to the end of the next few blocks, so a more urgent request does not wait for the whole range. */
+		completion = &request->completion;
+		length     = request->end - request->position;
+		if (length > 0 && (request->position / request->block_size + LIBMPQ_QUEUE_SLICE_BLOCKS) * request->block_size < request->end) {
+			length = (request->position / request->block_size + LIBMPQ_QUEUE_SLICE_BLOCKS) * request->block_size - request->position;
+		}
+
+		/* read without lock, so other workers run their requests meanwhile. */
+		libmpq__request_push(&mpq_queue->running, request);
+		pthread_mutex_unlock(&mpq_queue->lock);
+		result = libmpq__file_read_range(mpq_queue->mpq_archive, completion->file_number, request->position, completion->buffer + (request->position - completion->offset), length, &tb);
+		pthread_mutex_lock(&mpq_queue->lock);
+		libmpq__request_remove(&mpq_queue->running, request);
+
+		/* advance in range. */
+		request->position       += length;
+		completion->transferred += result == LIBMPQ_SUCCESS ? tb : 0;
+
+		/* check if request is not finished, then it waits for its next turn. */
+		if (result == LIBMPQ_SUCCESS && !request->cancel && request->position < request->end) {
+			libmpq__queue_enqueue(mpq_queue, request);
+			continue;
+		}
+
+		/* hand request to the caller. */
+		completion->result = result < 0 ? result : (request->cancel ? LIBMPQ_ERROR_CANCEL : LIBMPQ_SUCCESS);
+		libmpq__queue_finish(mpq_queue, request);
+	}
+
+	/* unlock the queue. */
+	pthread_mutex_unlock(&mpq_queue->lock);
+
+	/* worker finished. */
+	return NULL;
+}
+
+/* this function create a queue with the given number of worker threads. */
+int32_t libmpq__queue_open(mpq_archive_s *mpq_archive, uint32_t threads, mpq_queue_s **mpq_queue) {
+
+	/* some common variables. */
+	uint32_t i;
+
+	/* check if thread count is valid. */
+	if (threads == 0 || threads > LIBMPQ_POOL_THREADS_MAX) {
+
+		/* a queue without workers would never finish a request. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* allocate memory for the queue and its thread list. */
+	if ((*mpq_queue = calloc(1, sizeof(mpq_queue_s))) == NULL ||
+	    ((*mpq_queue)->thread = calloc(threads, sizeof(pthread_t))) == NULL) {
+
+		/* memory allocation problem. */
+		free(*mpq_queue);
+		*mpq_queue = NULL;
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* initialize lock and conditions. */
+	if (pthread_mutex_init(&(*mpq_queue)->lock, NULL) != 0) {
+		goto error;
+	}
+	if (pthread_cond_init(&(*mpq_queue)->work, NULL) != 0) {
+		pthread_mutex_destroy(&(*mpq_queue)->lock);
+		goto error;
+	}
+	if (pthread_cond_init(&(*mpq_queue)->done, NULL) != 0) {
+		pthread_cond_destroy(&(*mpq_queue)->work);
+		pthread_mutex_destroy(&(*mpq_queue)->lock);
+		goto error;
+	}
+	(*mpq_queue)->mpq_archive = mpq_archive;
+
+	/* start workers. */
+	for (i = 0; i < threads; i++) {
+
+		/* check if thread could be created. */
+		if (pthread_create(&(*mpq_queue)->thread[i], NULL, libmpq__queue_worker, *mpq_queue) != 0) {
+
+			/* stop the started workers like on a complete queue. */
+			(*mpq_queue)->threads = i;
+			libmpq__queue_close(*mpq_queue);
+			*mpq_queue = NULL;
+
+			/* thread resources are exhausted. */
+			return LIBMPQ_ERROR_MALLOC;
+		}
+	}
+	(*mpq_queue)->threads = threads;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+
+error:
+	/* free queue and thread list. */
+	free((*mpq_queue)->thread);
+	free(*mpq_queue);
+	*mpq_queue = NULL;
+
+	/* lock or conditions could not be created. */
+	return LIBMPQ_ERROR_MALLOC;
+}
+
+/* this function submit a read of a range of a file with a priority class and a deadline in microseconds from now, zero means none. */
+int32_t libmpq__queue_read_priority(mpq_queue_s *mpq_queue, uint32_t file_number, libmpq__off_t offset, uint8_t *out_buf, libmpq__off_t out_size, uint32_t priority, uint64_t deadline, void *data, uint64_t *ticket) {
+
+	/* some common variables. */
+	mpq_request_s *request;
+	uint32_t blocks         = 0;
+	int32_t result;
+	uint64_t now            = libmpq__queue_now();
+	libmpq__off_t unpacked_size = 0;
+
+	/* check if file exists, so the caller learns it right now. */
+	if ((result = libmpq__file_size_unpacked(mpq_queue->mpq_archive, file_number, &unpacked_size)) < 0) {
+
+		/* file does not exist. */
+		return result;
+	}
+
+	/* check if range and priority class are valid. */
+	if (offset < 0 || out_size < 0 || priority >= LIBMPQ_PRIORITY_CLASSES) {
+
+		/* range starts before the file, has negative size or class is unknown. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* get block count for file. */
+	libmpq__file_blocks(mpq_queue->mpq_archive, file_number, &blocks);
+
+	/* lock the queue. */
+	pthread_mutex_lock(&mpq_queue->lock);
+
+	/* take a kept request or allocate a new one. */
+	if ((request = mpq_queue->spare) != NULL) {
+		mpq_queue->spare = request->next;
+	} else if ((request = malloc(sizeof(mpq_request_s))) == NULL) {
+
+		/* memory allocation problem. */
+		pthread_mutex_unlock(&mpq_queue->lock);
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* fill request. */
+	request->completion.ticket      = ++mpq_queue->ticket;
+	request->completion.file_number = file_number;
+	request->completion.offset      = offset;
+	request->completion.buffer      = out_buf;
+	request->completion.transferred = 0;
+	request->completion.result      = LIBMPQ_SUCCESS;
+	request->completion.data        = data;
+	request->priority               = priority;
+	request->cancel                 = FALSE;
+	request->submitted              = now;
+	request->deadline               = deadline > 0 ? now + deadline : LIBMPQ_QUEUE_NO_DEADLINE;
+
+	/* clip range at the end of file, a file with one block may be larger than the archive block size if it is stored in a single sector. */
+	request->block_size = blocks == 1 ? unpacked_size : mpq_queue->mpq_archive->block_size;
+	request->position   = offset;
+	request->end        = offset < unpacked_size ? (out_size < unpacked_size - offset ? offset + out_size : unpacked_size) : offset;
+
+	/* check for null pointer. */
+	if (ticket != NULL) {
+
+		/* store ticket. */
+		*ticket = request->completion.ticket;
+	}
+
+	/* hand request to the workers. */
+	libmpq__queue_enqueue(mpq_queue, request);
+	mpq_queue->outstanding++;
+	pthread_cond_signal(&mpq_queue->work);
+
+	/* unlock the queue. */
+	pthread_mutex_unlock(&mpq_queue->lock);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function submit a read of a range of a file with normal priority, a whole file is read with offset zero and a size of at least the file size. */
+int32_t libmpq__queue_read(mpq_queue_s *mpq_queue, uint32_t file_number, libmpq__off_t offset, uint8_t *out_buf, libmpq__off_t out_size, void *data, uint64_t *ticket) {
+
+	/* submit without deadline. */
+	return libmpq__queue_read_priority(mpq_queue, file_number, offset, out_buf, out_size, LIBMPQ_PRIORITY_NORMAL, 0, data, ticket);
+}
+
+/* this function cancel a request which did not finish yet, it finishes with LIBMPQ_ERROR_CANCEL. */
+int32_t libmpq__queue_cancel(mpq_queue_s *mpq_queue, uint64_t ticket) {
+
+	/* some common variables. */
+	mpq_request_s *request = NULL;
+	uint32_t i;
+
+	/* lock the queue. */
+	pthread_mutex_lock(&mpq_queue->lock);
+
+	/* search request in the pending lists. */
+	for (i = 0; request == NULL && i < LIBMPQ_PRIORITY_CLASSES; i++) {
+		for (request = mpq_queue->pending[i].head; request != NULL && request->completion.ticket != ticket; request = request->next);
+	}
+
+	/* check if request is pending. */
+	if (request != NULL) {
+
+		/* finish request without reading further, so every ticket gets exactly one completion. */
+		libmpq__queue_dequeue(mpq_queue, request);
+		request->completion.result = LIBMPQ_ERROR_CANCEL;
+		libmpq__queue_finish(mpq_queue, request);
+
+		/* unlock the queue. */
+		pthread_mutex_unlock(&mpq_queue->lock);
+
+		/* if no error was found, return zero. */
+		return LIBMPQ_SUCCESS;
+	}
+
+	/* search request in the running list. */
+	for (request = mpq_queue->running.head; request != NULL && request->completion.ticket != ticket; request = request->next);
+
+	/* check if a worker reads a slice of it, then the request finishes after the slice. */
+	if (request != NULL) {
+		request->cancel = TRUE;
+	}
+
+	/* unlock the queue. */
+	pthread_mutex_unlock(&mpq_queue->lock);
+
+	/* check if request was found. */
+	if (request == NULL) {
+
+		/* request finished or was never submitted. */
+		return LIBMPQ_ERROR_EXIST;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function take the oldest finished request, the queue must be locked. */
+static int32_t libmpq__queue_collect(mpq_queue_s *mpq_queue, libmpq__completion_s *completion) {
+
+	/* some common variables. */
+	mpq_request_s *request;
+
+	/* check if any request finished. */
+	if ((request = libmpq__request_pop(&mpq_queue->finished)) == NULL) {
+
+		/* nothing to collect. */
+		return LIBMPQ_ERROR_EXIST;
+	}
+
+	/* copy completion and keep request for the next submit. */
+	*completion       = request->completion;
+	request->next     = mpq_queue->spare;
+	mpq_queue->spare  = request;
+	mpq_queue->outstanding--;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function take a finished request without waiting, LIBMPQ_ERROR_EXIST if none finished. */
+int32_t libmpq__queue_poll(mpq_queue_s *mpq_queue, libmpq__completion_s *completion) {
+
+	/* some common variables. */
+	int32_t result;
+
+	/* take finished request while locked. */
+	pthread_mutex_lock(&mpq_queue->lock);
+	result = libmpq__queue_collect(mpq_queue, completion);
+	pthread_mutex_unlock(&mpq_queue->lock);
+
+	/* return result of collecting. */
+	return result;
+}
+
+/* this function wait for a finished request, LIBMPQ_ERROR_EXIST if no request is outstanding. */
+int32_t libmpq__queue_wait(mpq_queue_s *mpq_queue, libmpq__completion_s *completion) {
+
+	/* some common variables. */
+	int32_t result;
+
+	/* lock the queue. */
+	pthread_mutex_lock(&mpq_queue->lock);
+
+	/* wait until a request finished, waiting without outstanding requests would never end. */
+	while (mpq_queue->finished.head == NULL && mpq_queue->outstanding > 0) {
+		pthread_cond_wait(&mpq_queue->done, &mpq_queue->lock);
+	}
+
+	/* take finished request. */
+	result = libmpq__queue_collect(mpq_queue, completion);
+
+	/* unlock the queue. */
+	pthread_mutex_unlock(&mpq_queue->lock);
+
+	/* return result of collecting. */
+	return result;
+}
+
+/* this function return the counters of a priority class. */
+int32_t libmpq__queue_stats(mpq_queue_s *mpq_queue, uint32_t priority, libmpq__queue_stats_s *stats) {
+
+	/* check if priority class is valid. */
+	if (priority >= LIBMPQ_PRIORITY_CLASSES) {
+
+		/* class is unknown. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* copy counters while locked, so they belong together. */
+	pthread_mutex_lock(&mpq_queue->lock);
+	*stats = mpq_queue->stats[priority];
+	pthread_mutex_unlock(&mpq_queue->lock);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function drop pending requests, wait for running ones and free the queue. */
+int32_t libmpq__queue_close(mpq_queue_s *mpq_queue) {
+
+	/* some common variables. */
+	uint32_t i;
+
+	/* tell workers to exit after their running slice. */
+	pthread_mutex_lock(&mpq_queue->lock);
+	mpq_queue->stop = TRUE;
+	pthread_cond_broadcast(&mpq_queue->work);
+	pthread_mutex_unlock(&mpq_queue->lock);
+
+	/* wait for all workers, no request runs afterwards. */
+	for (i = 0; i < mpq_queue->threads; i++) {
+		pthread_join(mpq_queue->thread[i], NULL);
+	}
+
+	/* free all requests, completions which were not collected are dropped. */
+	for (i = 0; i < LIBMPQ_PRIORITY_CLASSES; i++) {
+		libmpq__request_free(mpq_queue->pending[i].head);
+	}
+	libmpq__request_free(mpq_queue->finished.head);
+	libmpq__request_free(mpq_queue->spare);
+
+	/* free lock, conditions and the queue itself. */
+	pthread_cond_destroy(&mpq_queue->done);
+	pthread_cond_destroy(&mpq_queue->work);
+	pthread_mutex_destroy(&mpq_queue->lock);
+	free(mpq_queue->thread);
+	free(mpq_queue);
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
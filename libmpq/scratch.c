@@ -0,0 +1,168 @@
+/*
+ *  scratch.c -- per thread scratch buffers, so reading and unpacking blocks
+ *               needs no heap allocation once a thread has warmed up.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* mpq-tools configuration includes. */
+#include "config.h"
+
+/* libmpq main includes. */
+#include "mpq.h"
+#include "mpq-internal.h"
+
+/* libmpq generic includes. */
+#include "scratch.h"
+
+/* generic includes. */
+#include <pthread.h>
+#include <stdlib.h>
+
+/* scratch buffers of one thread. */
+typedef struct {
+	void		*buffer[LIBMPQ_SCRATCH_SLOTS];	/* kept buffer of each slot. */
+	size_t		size[LIBMPQ_SCRATCH_SLOTS];	/* size of the kept buffer of each slot. */
+} scratch_s;
+
+/* each thread gets its own buffers, so no locking is required. */
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+static uint32_t scratch_unavailable = FALSE;
+
+/* this function free all buffers of a thread. */
+static void libmpq__scratch_release(void *ptr) {
+
+	/* some common variables. */
+	scratch_s *scratch = ptr;
+	uint32_t i;
+
+	/* free buffers of all slots. */
+	for (i = 0; i < LIBMPQ_SCRATCH_SLOTS; i++) {
+		free(scratch->buffer[i]);
+	}
+
+	/* free buffer list. */
+	free(scratch);
+}
+
+/* this function create the thread key for the buffers. */
+static void libmpq__scratch_key(void) {
+
+	/* buffers are freed when their thread exits. */
+	if (pthread_key_create(&scratch_key, libmpq__scratch_release) != 0) {
+		__atomic_store_n(&scratch_unavailable, TRUE, __ATOMIC_RELAXED);
+	}
+}
+
+/* this function return the buffers of the calling thread, they are created on first use. */
+static scratch_s *libmpq__scratch_get(void) {
+
+	/* some common variables. */
+	scratch_s *scratch;
+
+	/* create thread key once. */
+	pthread_once(&scratch_once, libmpq__scratch_key);
+
+	/* check if thread specific data is usable at all. */
+	if (__atomic_load_n(&scratch_unavailable, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+
+	/* check if thread already has buffers. */
+	if ((scratch = pthread_getspecific(scratch_key)) != NULL) {
+		return scratch;
+	}
+
+	/* allocate memory for the buffer list. */
+	if ((scratch = calloc(1, sizeof(scratch_s))) == NULL) {
+		return NULL;
+	}
+
+	/* remember buffer list for this thread. */
+	if (pthread_setspecific(scratch_key, scratch) != 0) {
+		free(scratch);
+		return NULL;
+	}
+
+	/* return buffers. */
+	return scratch;
+}
+
+/* this function return a buffer of at least size bytes from the given slot of the calling thread. */
+void *libmpq__scratch_alloc(uint32_t slot, size_t size) {
+
+	/* some common variables. */
+	scratch_s *scratch;
+	void *buffer;
+
+	/* check if buffer is too large to be kept or the thread has no buffers. */
+	if (size > LIBMPQ_SCRATCH_MAX || (scratch = libmpq__scratch_get()) == NULL) {
+
+		/* allocate buffer for this use only, one extra byte avoids zero sized allocations. */
+		return malloc(size + 1);
+	}
+
+	/* check if kept buffer is large enough, which is the common case. */
+	if (scratch->size[slot] >= size) {
+		return scratch->buffer[slot];
+	}
+
+	/* grow to the next power of two, so few sizes are seen before the buffer stops growing. */
+	size = size < 4096 ? 4096 : size;
+	size--;
+	size |= size >> 1;
+	size |= size >> 2;
+	size |= size >> 4;
+	size |= size >> 8;
+	size |= size >> 16;
+	size++;
+
+	/* allocate new buffer, contents of the old one are not needed. */
+	if ((buffer = malloc(size)) == NULL) {
+		return NULL;
+	}
+
+	/* replace kept buffer. */
+	free(scratch->buffer[slot]);
+	scratch->buffer[slot] = buffer;
+	scratch->size[slot]   = size;
+
+	/* return buffer. */
+	return buffer;
+}
+
+/* this function release a buffer returned by libmpq__scratch_alloc(). */
+void libmpq__scratch_free(uint32_t slot, void *buffer) {
+
+	/* some common variables. */
+	scratch_s *scratch;
+
+	/* create thread key once, oversized buffers may be released before any buffer was kept. */
+	pthread_once(&scratch_once, libmpq__scratch_key);
+
+	/* check if buffer is kept by the calling thread. */
+	if (buffer == NULL ||
+	    (!__atomic_load_n(&scratch_unavailable, __ATOMIC_RELAXED) &&
+	     (scratch = pthread_getspecific(scratch_key)) != NULL &&
+	     scratch->buffer[slot] == buffer)) {
+		return;
+	}
+
+	/* free buffer which was allocated for one use. */
+	free(buffer);
+}
@@ -0,0 +1,54 @@
+/*
+ *  scratch.h -- header for the per thread scratch buffers used while reading
+ *               and unpacking blocks.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _SCRATCH_H
+#define _SCRATCH_H
+
+/* generic includes. */
+#include <stddef.h>
+#include <stdint.h>
+
+/* define scratch slots, a slot must not be used twice at the same time by one thread. */
+#define LIBMPQ_SCRATCH_PACKED			0		/* packed blocks read from the archive. */
+#define LIBMPQ_SCRATCH_REQUESTS			1		/* read requests or block list of a file read. */
+#define LIBMPQ_SCRATCH_MULTI			2		/* intermediate data of multiple decompressions. */
+#define LIBMPQ_SCRATCH_HUFFMAN			3		/* huffman tree. */
+#define LIBMPQ_SCRATCH_HUFFMAN_INPUT		4		/* huffman input stream. */
+#define LIBMPQ_SCRATCH_PKZIP			5		/* pkzip work buffer. */
+#define LIBMPQ_SCRATCH_UNPACKED			6		/* unpacked block of which only a piece is wanted. */
+#define LIBMPQ_SCRATCH_SLOTS			7		/* number of slots. */
+
+/* define the largest buffer which is kept, larger ones are allocated on every use. */
+#define LIBMPQ_SCRATCH_MAX			(1024 * 1024)
+
+/* return a buffer of at least size bytes from the given slot of the calling thread, NULL on allocation failure. */
+void *libmpq__scratch_alloc(
+	uint32_t		slot,
+	size_t			size
+);
+
+/* release a buffer returned by libmpq__scratch_alloc(), only buffers which were not kept are freed. */
+void libmpq__scratch_free(
+	uint32_t		slot,
+	void			*buffer
+);
+
+#endif						/* _SCRATCH_H */
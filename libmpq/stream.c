@@ -0,0 +1,433 @@
+/*
+ *  stream.c -- file handles which read a file piece by piece and only
+ *              unpack the blocks which are touched, optionally unpacking
+ *              the following blocks ahead while the file is read in order.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* mpq-tools configuration includes. */
+#include "config.h"
+
+/* libmpq main includes. */
+#include "mpq.h"
+#include "mpq-internal.h"
+
+/* generic includes. */
+#include <stdlib.h>
+#include <string.h>
+
+/* define the block number of a stream which has no unpacked block. */
+#define LIBMPQ_STREAM_NO_BLOCK			0xFFFFFFFF
+
+/* define states of a readahead slot. */
+#define LIBMPQ_STREAM_SLOT_EMPTY		0		/* slot holds no block. */
+#define LIBMPQ_STREAM_SLOT_PENDING		1		/* block is unpacked by the queue. */
+#define LIBMPQ_STREAM_SLOT_READY		2		/* block is unpacked. */
+
+/* block unpacked ahead of the position. */
+typedef struct {
+	uint8_t		*buffer;		/* unpacked block. */
+	uint32_t	block_number;		/* block which is in the buffer. */
+	uint32_t	state;			/* one of the slot states. */
+	uint64_t	ticket;			/* ticket of the read while the slot is pending. */
+	int32_t		result;			/* result of the read when the slot is ready. */
+	libmpq__off_t	transferred;		/* bytes unpacked into the buffer when the slot is ready. */
+} mpq_stream_slot_s;
+
+/* file handle with a position and the last unpacked block. */
+struct mpq_stream {
+	mpq_archive_s	*mpq_archive;		/* archive the file belongs to. */
+	uint32_t	file_number;		/* file which is read. */
+	uint32_t	block_number;		/* block which is in the buffer. */
+	uint32_t	blocks;			/* number of blocks of the file. */
+	libmpq__off_t	block_size;		/* unpacked size of all blocks but the last one. */
+	libmpq__off_t	size;			/* unpacked size of the file. */
+	libmpq__off_t	offset;			/* current position in the unpacked file. */
+	uint8_t		*buffer;		/* last unpacked block, allocated on first use. */
+	uint32_t	last_block;		/* block touched by the last read, to detect reading in order. */
+	uint32_t	ahead;			/* number of blocks unpacked ahead, zero if readahead is off. */
+	mpq_stream_slot_s *slot;		/* ring of ahead plus one slots, block n lives in slot n modulo its size. */
+	mpq_queue_s	*mpq_queue;		/* queue with one worker which unpacks the blocks ahead. */
+};
+
+/* this function open a file for reading it piece by piece. */
+int32_t libmpq__stream_open(mpq_archive_s *mpq_archive, uint32_t file_number, mpq_stream_s **mpq_stream) {
+
+	/* some common variables. */
+	uint32_t blocks = 0;
+	int32_t result  = 0;
+	libmpq__off_t unpacked_size = 0;
+
+	/* get unpacked size, which also checks the file number. */
+	if ((result = libmpq__file_size_unpacked(mpq_archive, file_number, &unpacked_size)) < 0) {
+
+		/* file does not exist. */
+		return result;
+	}
+
+	/* get block count for file. */
+	libmpq__file_blocks(mpq_archive, file_number, &blocks);
+
+	/* allocate memory for the handle. */
+	if ((*mpq_stream = calloc(1, sizeof(mpq_stream_s))) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* open the packed block offset table, it stays open as long as the handle. */
+	if ((result = libmpq__block_open_offset(mpq_archive, file_number)) < 0) {
+
+		/* free handle. */
+		free(*mpq_stream);
+		*mpq_stream = NULL;
+
+		/* something on opening packed block offset table failed. */
+		return result;
+	}
+
+	/* fill handle, a file with one block may be larger than the archive block size if it is stored in a single sector. */
+	(*mpq_stream)->mpq_archive  = mpq_archive;
+	(*mpq_stream)->file_number  = file_number;
+	(*mpq_stream)->block_number = LIBMPQ_STREAM_NO_BLOCK;
+	(*mpq_stream)->blocks       = blocks;
+	(*mpq_stream)->block_size   = blocks == 1 ? unpacked_size : mpq_archive->block_size;
+	(*mpq_stream)->size         = unpacked_size;
+	(*mpq_stream)->last_block   = LIBMPQ_STREAM_NO_BLOCK;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function mark the slot of a finished read of the readahead queue. */
+static void libmpq__stream_complete(libmpq__completion_s *completion) {
+
+	/* some common variables. */
+	mpq_stream_slot_s *slot = completion->data;
+
+	/* a cancelled block is forgotten, a failed one is read again by the reader to get its error. */
+	slot->state       = completion->result == LIBMPQ_ERROR_CANCEL ? LIBMPQ_STREAM_SLOT_EMPTY : LIBMPQ_STREAM_SLOT_READY;
+	slot->result      = completion->result;
+	slot->transferred = completion->transferred;
+}
+
+/* this function drop all blocks read ahead and wait for reads which are still running. */
+static void libmpq__stream_drop(mpq_stream_s *mpq_stream) {
+
+	/* some common variables. */
+	libmpq__completion_s completion;
+	uint32_t i;
+
+	/* cancel pending reads and forget unpacked blocks. */
+	for (i = 0; i <= mpq_stream->ahead; i++) {
+		if (mpq_stream->slot[i].state == LIBMPQ_STREAM_SLOT_PENDING) {
+			libmpq__queue_cancel(mpq_stream->mpq_queue, mpq_stream->slot[i].ticket);
+		} else {
+			mpq_stream->slot[i].state = LIBMPQ_STREAM_SLOT_EMPTY;
+		}
+	}
+
+	/* collect all reads, so no worker writes into a slot afterwards. */
+	while (libmpq__queue_wait(mpq_stream->mpq_queue, &completion) == 0) {
+		((mpq_stream_slot_s *)completion.data)->state = LIBMPQ_STREAM_SLOT_EMPTY;
+	}
+}
+
+/* this function return the given block if it was read ahead and submit reads of the following blocks. */
+static mpq_stream_slot_s *libmpq__stream_ahead(mpq_stream_s *mpq_stream, uint32_t block_number) {
+
+	/* some common variables. */
+	libmpq__completion_s completion;
+	mpq_stream_slot_s *slot;
+	uint32_t i;
+
+	/* check if block is the same as before, nothing changes then. */
+	if (block_number == mpq_stream->last_block) {
+		slot = &mpq_stream->slot[block_number % (mpq_stream->ahead + 1)];
+		return slot->block_number == block_number && slot->state == LIBMPQ_STREAM_SLOT_READY && slot->result == LIBMPQ_SUCCESS ? slot : NULL;
+	}
+
+	/* check if file is not read in order anymore, then blocks ahead are useless, the first block counts as in order after open. */
+	if (block_number != mpq_stream->last_block + 1) {
+		mpq_stream->last_block = block_number;
+		libmpq__stream_drop(mpq_stream);
+		return NULL;
+	}
+	mpq_stream->last_block = block_number;
+
+	/* submit reads of the blocks following the wanted one, slots which still wait for an old read are filled later. */
+	for (i = block_number + 1; i < mpq_stream->blocks && i - block_number <= mpq_stream->ahead; i++) {
+
+		/* check if block is already read ahead or slot is busy. */
+		slot = &mpq_stream->slot[i % (mpq_stream->ahead + 1)];
+		if ((slot->block_number == i && slot->state != LIBMPQ_STREAM_SLOT_EMPTY) || slot->state == LIBMPQ_STREAM_SLOT_PENDING) {
+			continue;
+		}
+
+		/* submit read of the whole block, on failure the block is simply read when it is reached. */
+		slot->block_number = i;
+		slot->state        = LIBMPQ_STREAM_SLOT_EMPTY;
+		if (libmpq__queue_read(mpq_stream->mpq_queue, mpq_stream->file_number, (libmpq__off_t)i * mpq_stream->block_size, slot->buffer, mpq_stream->block_size, slot, &slot->ticket) == 0) {
+			slot->state = LIBMPQ_STREAM_SLOT_PENDING;
+		}
+	}
+
+	/* check if wanted block was read ahead. */
+	slot = &mpq_stream->slot[block_number % (mpq_stream->ahead + 1)];
+	if (slot->block_number != block_number || slot->state == LIBMPQ_STREAM_SLOT_EMPTY) {
+		return NULL;
+	}
+
+	/* wait until its read finished, the single worker finishes reads in order. */
+	while (slot->state == LIBMPQ_STREAM_SLOT_PENDING && libmpq__queue_wait(mpq_stream->mpq_queue, &completion) == 0) {
+		libmpq__stream_complete(&completion);
+	}
+
+	/* return block if it was unpacked without error. */
+	return slot->state == LIBMPQ_STREAM_SLOT_READY && slot->result == LIBMPQ_SUCCESS ? slot : NULL;
+}
+
+/* this function read from the current position and advance it by the number of bytes read. */
+int32_t libmpq__stream_read(mpq_stream_s *mpq_stream, uint8_t *out_buf, libmpq__off_t out_size, libmpq__off_t *transferred) {
+
+	/* some common variables. */
+	uint32_t block_number;
+	int32_t result          = 0;
+	libmpq__off_t block_offset;
+	libmpq__off_t unpacked_size;
+	libmpq__off_t length;
+	libmpq__off_t total     = 0;
+	libmpq__off_t tb        = 0;
+	mpq_stream_slot_s *slot;
+
+	/* check if size is valid. */
+	if (out_size < 0) {
+
+		/* negative size makes no sense. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* loop until buffer is full or end of file is reached. */
+	while (total < out_size && mpq_stream->offset < mpq_stream->size) {
+
+		/* map position to block. */
+		block_number = mpq_stream->offset / mpq_stream->block_size;
+		block_offset = mpq_stream->offset - (libmpq__off_t)block_number * mpq_stream->block_size;
+
+		/* get unpacked block size. */
+		libmpq__block_size_unpacked(mpq_stream->mpq_archive, mpq_stream->file_number, block_number, &unpacked_size);
+
+		/* check if block was unpacked ahead as a whole, then it is only copied, otherwise a block which is wanted as a whole and not unpacked yet is unpacked straight into the output buffer. */
+		if (mpq_stream->ahead > 0 && (slot = libmpq__stream_ahead(mpq_stream, block_number)) != NULL && slot->transferred == unpacked_size) {
+
+			/* copy wanted part of the block. */
+			length = unpacked_size - block_offset < out_size - total ? unpacked_size - block_offset : out_size - total;
+			memcpy(out_buf + total, slot->buffer + block_offset, length);
+		} else if (block_offset == 0 && out_size - total >= unpacked_size && block_number != mpq_stream->block_number) {
+
+			/* read block. */
+			if ((result = libmpq__block_read(mpq_stream->mpq_archive, mpq_stream->file_number, block_number, out_buf + total, unpacked_size, &tb)) < 0) {
+				break;
+			}
+
+			/* check if block unpacked to the size given by the block table. */
+			if (tb != unpacked_size) {
+				result = LIBMPQ_ERROR_UNPACK;
+				break;
+			}
+
+			/* whole block was copied. */
+			length = unpacked_size;
+		} else {
+
+			/* check if block has to be unpacked. */
+			if (block_number != mpq_stream->block_number) {
+
+				/* allocate buffer on first use, one extra byte avoids zero sized allocations. */
+				if (mpq_stream->buffer == NULL && (mpq_stream->buffer = malloc(mpq_stream->block_size + 1)) == NULL) {
+
+					/* memory allocation problem. */
+					result = LIBMPQ_ERROR_MALLOC;
+					break;
+				}
+
+				/* forget old block, so a failed read leaves no stale data behind. */
+				mpq_stream->block_number = LIBMPQ_STREAM_NO_BLOCK;
+
+				/* read block. */
+				if ((result = libmpq__block_read(mpq_stream->mpq_archive, mpq_stream->file_number, block_number, mpq_stream->buffer, unpacked_size, &tb)) < 0) {
+					break;
+				}
+
+				/* check if block unpacked to the size given by the block table, otherwise the buffer holds stale data. */
+				if (tb != unpacked_size) {
+					result = LIBMPQ_ERROR_UNPACK;
+					break;
+				}
+
+				/* remember unpacked block. */
+				mpq_stream->block_number = block_number;
+			}
+
+			/* copy wanted part of the block. */
+			length = unpacked_size - block_offset < out_size - total ? unpacked_size - block_offset : out_size - total;
+			memcpy(out_buf + total, mpq_stream->buffer + block_offset, length);
+		}
+
+		/* advance position. */
+		total              += length;
+		mpq_stream->offset += length;
+	}
+
+	/* check for null pointer. */
+	if (transferred != NULL) {
+
+		/* store transferred bytes, also if reading stopped early. */
+		*transferred = total;
+	}
+
+	/* return result of the last read. */
+	return result;
+}
+
+/* this function set the number of blocks which are unpacked ahead while the file is read in order, zero turns it off. */
+int32_t libmpq__stream_readahead(mpq_stream_s *mpq_stream, uint32_t blocks) {
+
+	/* some common variables. */
+	int32_t result = 0;
+	uint32_t i;
+
+	/* check if readahead was on, then its blocks and queue are freed. */
+	if (mpq_stream->ahead > 0) {
+
+		/* wait for running reads and close the queue. */
+		libmpq__stream_drop(mpq_stream);
+		libmpq__queue_close(mpq_stream->mpq_queue);
+
+		/* free slots. */
+		for (i = 0; i <= mpq_stream->ahead; i++) {
+			free(mpq_stream->slot[i].buffer);
+		}
+		free(mpq_stream->slot);
+		mpq_stream->slot       = NULL;
+		mpq_stream->mpq_queue  = NULL;
+		mpq_stream->ahead      = 0;
+	}
+
+	/* check if readahead is wanted. */
+	if (blocks == 0) {
+
+		/* if no error was found, return zero. */
+		return LIBMPQ_SUCCESS;
+	}
+
+	/* check if ring size overflows. */
+	if (blocks == 0xFFFFFFFF) {
+
+		/* too many blocks. */
+		return LIBMPQ_ERROR_SIZE;
+	}
+
+	/* allocate memory for the slots, one more than blocks ahead holds the block at the position. */
+	if ((mpq_stream->slot = calloc(blocks + 1, sizeof(mpq_stream_slot_s))) == NULL) {
+
+		/* memory allocation problem. */
+		return LIBMPQ_ERROR_MALLOC;
+	}
+
+	/* allocate memory for the blocks, one extra byte avoids zero sized allocations. */
+	for (i = 0; i <= blocks; i++) {
+		mpq_stream->slot[i].block_number = LIBMPQ_STREAM_NO_BLOCK;
+		if ((mpq_stream->slot[i].buffer = malloc(mpq_stream->block_size + 1)) == NULL) {
+			result = LIBMPQ_ERROR_MALLOC;
+			break;
+		}
+	}
+
+	/* open queue with a single worker, so blocks are unpacked in order. */
+	if (result == 0) {
+		result = libmpq__queue_open(mpq_stream->mpq_archive, 1, &mpq_stream->mpq_queue);
+	}
+
+	/* check if something failed. */
+	if (result < 0) {
+
+		/* free slots. */
+		for (i = 0; i <= blocks; i++) {
+			free(mpq_stream->slot[i].buffer);
+		}
+		free(mpq_stream->slot);
+		mpq_stream->slot = NULL;
+
+		/* memory or thread resources are exhausted. */
+		return result;
+	}
+
+	/* turn readahead on, the next read in order starts it. */
+	mpq_stream->ahead = blocks;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function set the current position, positions behind the end of file are allowed and read nothing. */
+int32_t libmpq__stream_seek(mpq_stream_s *mpq_stream, libmpq__off_t offset) {
+
+	/* check if position is valid. */
+	if (offset < 0) {
+
+		/* position before the begin of file. */
+		return LIBMPQ_ERROR_SEEK;
+	}
+
+	/* set position, the block is unpacked by the next read. */
+	mpq_stream->offset = offset;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function return the current position. */
+int32_t libmpq__stream_tell(mpq_stream_s *mpq_stream, libmpq__off_t *offset) {
+
+	/* return position. */
+	*offset = mpq_stream->offset;
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function close the handle and free the unpacked block. */
+int32_t libmpq__stream_close(mpq_stream_s *mpq_stream) {
+
+	/* some common variables. */
+	int32_t result;
+
+	/* stop readahead before the table is closed, its worker uses it. */
+	libmpq__stream_readahead(mpq_stream, 0);
+
+	/* close the packed block offset table. */
+	result = libmpq__block_close_offset(mpq_stream->mpq_archive, mpq_stream->file_number);
+
+	/* free buffer and handle. */
+	free(mpq_stream->buffer);
+	free(mpq_stream);
+
+	/* return result of closing the table. */
+	return result;
+}
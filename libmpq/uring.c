@@ -0,0 +1,378 @@
+/*
+ *  uring.c -- batch reader which keeps many sector reads in flight using
+ *             the linux io_uring interface.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* mpq-tools configuration includes. */
+#include "config.h"
+
+/* libmpq main includes. */
+#include "mpq.h"
+#include "mpq-internal.h"
+
+/* libmpq generic includes. */
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+/* generic includes. */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* io_uring includes. */
+#include <linux/io_uring.h>
+
+/* submission and completion ring of one thread. */
+typedef struct {
+	int			fd;		/* io_uring file descriptor. */
+	uint32_t		entries;	/* number of submission queue entries. */
+	uint8_t			*sq_ring;	/* mapped submission ring. */
+	size_t			sq_ring_size;	/* size of mapped submission ring. */
+	uint8_t			*cq_ring;	/* mapped completion ring, may be the same as the submission ring. */
+	size_t			cq_ring_size;	/* size of mapped completion ring. */
+	struct io_uring_sqe	*sqes;		/* mapped submission queue entries. */
+	size_t			sqes_size;	/* size of mapped submission queue entries. */
+	uint32_t		*sq_head;	/* submission ring head, moved by the kernel. */
+	uint32_t		*sq_tail;	/* submission ring tail, moved by us. */
+	uint32_t		sq_mask;	/* submission ring index mask. */
+	uint32_t		*sq_array;	/* submission ring index array. */
+	uint32_t		*cq_head;	/* completion ring head, moved by us. */
+	uint32_t		*cq_tail;	/* completion ring tail, moved by the kernel. */
+	uint32_t		cq_mask;	/* completion ring index mask. */
+	struct io_uring_cqe	*cqes;		/* completion queue entries. */
+} uring_s;
+
+/* each thread gets its own ring, so no locking is required. */
+static pthread_key_t uring_key;
+static pthread_once_t uring_once = PTHREAD_ONCE_INIT;
+static uint32_t uring_unavailable = FALSE;
+
+/* this function unmap and close a ring. */
+static void libmpq__uring_free(void *ptr) {
+
+	/* some common variables. */
+	uring_s *ring = ptr;
+
+	/* unmap everything which was mapped. */
+	if (ring->sqes != NULL) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	if (ring->sq_ring != NULL) {
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	}
+
+	/* close ring file descriptor. */
+	if (ring->fd >= 0) {
+		close(ring->fd);
+	}
+
+	/* free ring. */
+	free(ring);
+}
+
+/* this function create the thread key for the rings. */
+static void libmpq__uring_key(void) {
+
+	/* rings are freed when their thread exits. */
+	if (pthread_key_create(&uring_key, libmpq__uring_free) != 0) {
+		__atomic_store_n(&uring_unavailable, TRUE, __ATOMIC_RELAXED);
+	}
+}
+
+/* this function return the ring of the calling thread, it is created on first use. */
+static uring_s *libmpq__uring_get(void) {
+
+	/* some common variables. */
+	struct io_uring_params params;
+	uring_s *ring;
+
+	/* create thread key once. */
+	pthread_once(&uring_once, libmpq__uring_key);
+
+	/* check if io_uring is known to be unusable, e.g. old kernel or blocked by seccomp. */
+	if (__atomic_load_n(&uring_unavailable, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+
+	/* check if thread already has a ring. */
+	if ((ring = pthread_getspecific(uring_key)) != NULL) {
+		return ring;
+	}
+
+	/* allocate memory for the ring. */
+	if ((ring = calloc(1, sizeof(uring_s))) == NULL) {
+		return NULL;
+	}
+
+	/* create ring. */
+	memset(&params, 0, sizeof(params));
+	if ((ring->fd = syscall(__NR_io_uring_setup, LIBMPQ_URING_ENTRIES, &params)) < 0) {
+
+		/* remember that io_uring is not there, so we don't try again. */
+		if (errno == ENOSYS || errno == EPERM || errno == EACCES) {
+			__atomic_store_n(&uring_unavailable, TRUE, __ATOMIC_RELAXED);
+		}
+
+		/* free ring. */
+		free(ring);
+		return NULL;
+	}
+
+	/* compute size of rings, newer kernels map both rings at once. */
+	ring->entries      = params.sq_entries;
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size    = params.sq_entries * sizeof(struct io_uring_sqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ring->sq_ring_size = ring->cq_ring_size = ring->sq_ring_size > ring->cq_ring_size ? ring->sq_ring_size : ring->cq_ring_size;
+	}
+
+	/* map submission ring. */
+	if ((ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		libmpq__uring_free(ring);
+		return NULL;
+	}
+
+	/* map completion ring. */
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ring->cq_ring = ring->sq_ring;
+	} else if ((ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+		ring->cq_ring = NULL;
+		libmpq__uring_free(ring);
+		return NULL;
+	}
+
+	/* map submission queue entries. */
+	if ((ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES)) == MAP_FAILED) {
+		ring->sqes = NULL;
+		libmpq__uring_free(ring);
+		return NULL;
+	}
+
+	/* store pointers into the rings. */
+	ring->sq_head  = (uint32_t *)(ring->sq_ring + params.sq_off.head);
+	ring->sq_tail  = (uint32_t *)(ring->sq_ring + params.sq_off.tail);
+	ring->sq_mask  = *(uint32_t *)(ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_array = (uint32_t *)(ring->sq_ring + params.sq_off.array);
+	ring->cq_head  = (uint32_t *)(ring->cq_ring + params.cq_off.head);
+	ring->cq_tail  = (uint32_t *)(ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask  = *(uint32_t *)(ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes     = (struct io_uring_cqe *)(ring->cq_ring + params.cq_off.cqes);
+
+	/* attach ring to thread. */
+	if (pthread_setspecific(uring_key, ring) != 0) {
+		libmpq__uring_free(ring);
+		return NULL;
+	}
+
+	/* return ring. */
+	return ring;
+}
+
+/* this function finish a request synchronously, used for short reads and kernels without IORING_OP_READ. */
+static int32_t libmpq__uring_pread(int fd, libmpq__io_request_s *request, libmpq__off_t done) {
+
+	/* some common variables. */
+	ssize_t rb;
+
+	/* read the remaining part. */
+	while (done < request->size) {
+
+		/* read next chunk from file. */
+		if ((rb = pread(fd, (uint8_t *)request->buffer + done, request->size - done, request->offset + done)) <= 0) {
+
+			/* check if read was interrupted. */
+			if (rb < 0 && errno == EINTR) {
+				continue;
+			}
+
+			/* something on read failed. */
+			return LIBMPQ_ERROR_READ;
+		}
+
+		/* move to the remaining part. */
+		done += rb;
+	}
+
+	/* if no error was found, return zero. */
+	return LIBMPQ_SUCCESS;
+}
+
+/* this function wait for all reads the kernel took from a broken ring and detach it from the thread, so no read finishes into a buffer which was handed back already. */
+static void libmpq__uring_drop(uring_s *ring, uint32_t in_kernel) {
+
+	/* some common variables. */
+	uint32_t head;
+
+	/* loop until all taken reads finished or waiting fails as well. */
+	while (TRUE) {
+
+		/* discard all available completions, their requests fail anyway. */
+		head = *ring->cq_head;
+		while (in_kernel > 0 && head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			head++;
+			in_kernel--;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+		/* check if all reads finished. */
+		if (in_kernel == 0) {
+			break;
+		}
+
+		/* wait for next completion without submitting anything. */
+		if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR && errno != EAGAIN) {
+			break;
+		}
+	}
+
+	/* detach and close ring, entries which were never submitted die with it and closing cancels reads which did not finish. */
+	pthread_setspecific(uring_key, NULL);
+	libmpq__uring_free(ring);
+}
+
+/* this function read all requests with io_uring and call complete for each one as soon as it finished. */
+int32_t libmpq__uring_read_batch(int fd, libmpq__io_request_s *requests, uint32_t count, libmpq__io_complete_t complete, void *data) {
+
+	/* some common variables. */
+	uring_s *ring;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	libmpq__io_request_s *request;
+	uint32_t submitted = 0;
+	uint32_t finished  = 0;
+	uint32_t in_flight = 0;
+	uint32_t to_submit = 0;
+	uint32_t tail;
+	uint32_t head;
+	int32_t result     = LIBMPQ_SUCCESS;
+	int ret;
+
+	/* check if we have a ring. */
+	if ((ring = libmpq__uring_get()) == NULL) {
+
+		/* io_uring is not available, let the caller fall back. */
+		return LIBMPQ_ERROR_OPEN;
+	}
+
+	/* loop until all requests are finished. */
+	while (finished < count) {
+
+		/* fill the submission ring with as many requests as fit. */
+		tail = *ring->sq_tail;
+		while (submitted < count && in_flight < ring->entries) {
+
+			/* prepare read of the next request. */
+			sqe = &ring->sqes[tail & ring->sq_mask];
+			memset(sqe, 0, sizeof(struct io_uring_sqe));
+			sqe->opcode    = IORING_OP_READ;
+			sqe->fd        = fd;
+			sqe->addr      = (uintptr_t)requests[submitted].buffer;
+			sqe->len       = requests[submitted].size;
+			sqe->off       = requests[submitted].offset;
+			sqe->user_data = submitted;
+
+			/* add entry to the ring. */
+			ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+			tail++;
+			submitted++;
+			in_flight++;
+			to_submit++;
+		}
+
+		/* publish new entries to the kernel. */
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+		/* submit new entries and wait for at least one completion. */
+		if ((ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0)) < 0) {
+
+			/* check if we got interrupted. */
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+				continue;
+			}
+
+			/* ring is broken, so wait for the reads the kernel took and let the next batch start with a new ring. */
+			libmpq__uring_drop(ring, in_flight - to_submit);
+			return LIBMPQ_ERROR_READ;
+		}
+
+		/* the kernel consumed what we submitted. */
+		to_submit -= (uint32_t)ret < to_submit ? (uint32_t)ret : to_submit;
+
+		/* reap all available completions. */
+		head = *ring->cq_head;
+		while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+
+			/* fetch completion. */
+			cqe     = &ring->cqes[head & ring->cq_mask];
+			request = &requests[cqe->user_data];
+
+			/* check result, short reads and unsupported operations are finished with pread. */
+			if (cqe->res == request->size) {
+				request->result = LIBMPQ_SUCCESS;
+			} else {
+				request->result = libmpq__uring_pread(fd, request, cqe->res > 0 ? cqe->res : 0);
+			}
+
+			/* remember first error. */
+			if (request->result < 0 && result == LIBMPQ_SUCCESS) {
+				result = request->result;
+			}
+
+			/* release completion entry. */
+			head++;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+			in_flight--;
+			finished++;
+
+			/* notify caller, so data can be processed while other reads are in flight. */
+			if (complete != NULL) {
+				complete(request, data);
+			}
+		}
+	}
+
+	/* return first error or zero. */
+	return result;
+}
+
+#else
+
+/* this function is a stub for systems without io_uring. */
+int32_t libmpq__uring_read_batch(int fd, libmpq__io_request_s *requests, uint32_t count, libmpq__io_complete_t complete, void *data) {
+
+	/* io_uring is not available, let the caller fall back. */
+	(void)fd;
+	(void)requests;
+	(void)count;
+	(void)complete;
+	(void)data;
+	return LIBMPQ_ERROR_OPEN;
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ *  uring.h -- header for the io_uring based batch reader.
+ *
+ *  Copyright (c) 2003-2011 Maik Broemme <mbroemme@libmpq.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _URING_H
+#define _URING_H
+
+/* number of reads which are in flight at the same time. */
+#define LIBMPQ_URING_ENTRIES			64
+
+/*
+ *  read all requests from the file descriptor with io_uring and call complete
+ *  for each one as soon as it finished. returns LIBMPQ_ERROR_OPEN without
+ *  touching any request if io_uring is not available, so the caller can fall
+ *  back to synchronous reads.
+ */
+int32_t libmpq__uring_read_batch(
+	int			fd,
+	libmpq__io_request_s	*requests,
+	uint32_t		count,
+	libmpq__io_complete_t	complete,
+	void			*data
+);
+
+#endif						/* _URING_H */